@@ -3,6 +3,7 @@
 //----------------------------------------------------------------------------
 
 #include "chip8.h"
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -18,6 +19,9 @@ void Chip8::reset()
 	drawFlag = false;
 	soundTimer = 0;
 	delayTimer = 0;
+	randomState = 1;
+	instructionCount = 0;
+	drawCount = 0;
 
 	// clear gfx and memory etc.
 	memset(gfx, 0, screenSize);
@@ -25,12 +29,19 @@ void Chip8::reset()
 	memset(stack, 0, stackSize * sizeof(unsigned short));
 	memset(regs, 0, 16);
 	memset(keys, 0, 16);
+	memset(keyTimes, 0, sizeof(keyTimes));
+	memset(inputTimes, 0, sizeof(inputTimes));
+	memset(latencyTimes, 0, sizeof(latencyTimes));
+	inputPending = false;
+	latencyPending = false;
 
 	// Load fontset
 	for (int i = 0; i < 80; ++i) 
 	{
 		memory[fontBase + i] = chip8Fontset[i];
 	}
+
+	rehash();
 }
 
 //----------------------------------------------------------------------------
@@ -39,7 +50,7 @@ void Chip8::reset()
 bool Chip8::load(std::string filename)
 {
 	// lets try and load a rom file
-	std::basic_fstream<unsigned char> romFile;
+	std::ifstream romFile;
 	romFile.open(filename, std::ios::binary | std::ios::in);
 
 	if(romFile.is_open())
@@ -52,8 +63,9 @@ bool Chip8::load(std::string filename)
 
 		if (fsize <= maxProgSize)
 		{
-			unsigned char *m = memory + progBase;
+			char *m = (char *)memory + progBase;
 			romFile.read(m, fsize);
+			rehash();
 			std::cout << "Loaded ROM " << filename << std::endl;
 			return true;
 		}
@@ -78,6 +90,7 @@ void Chip8::tick()
 {
 	currentOpcode = memory[pc] << 8 | memory[pc + 1];
 	decodeAndExecute(currentOpcode);
+	instructionCount++;
 	return;
 }
 
@@ -118,6 +131,204 @@ bool Chip8::willBeep()
 	return beepFlag;
 }
 
+//----------------------------------------------------------------------------
+// seedRandom - each Chip8 has its own random numbers for CXNN so that
+// instances can run side by side and be replayed exactly
+//----------------------------------------------------------------------------
+void Chip8::seedRandom(unsigned int seed)
+{
+	randomState = seed;
+}
+
+//----------------------------------------------------------------------------
+// random - same LCG as the MSVC rand(), so the default seed of 1 gives
+// the same numbers we always had
+//----------------------------------------------------------------------------
+unsigned int Chip8::random()
+{
+	randomState = randomState * 214013 + 2531011;
+	return (randomState >> 16) & 0x7fff;
+}
+
+//----------------------------------------------------------------------------
+// stateHash - Zobrist style hash of the whole machine state. memory, regs,
+// stack and gfx are kept up to date as they are written, so this is O(1)
+//----------------------------------------------------------------------------
+unsigned long long Chip8::stateHash()
+{
+	return dataHash ^ screenHash ^ scalarHash();
+}
+
+//----------------------------------------------------------------------------
+// computeStateHash - rebuilds the hash from scratch. Much slower than
+// stateHash() but useful for checking the incremental version
+//----------------------------------------------------------------------------
+unsigned long long Chip8::computeStateHash()
+{
+	unsigned long long h = 0;
+
+	for (int i = 0; i < memorySize; ++i)
+	{
+		h ^= hashSlot(memorySlot + i, memory[i]);
+	}
+	for (int i = 0; i < numRegs; ++i)
+	{
+		h ^= hashSlot(regsSlot + i, regs[i]);
+	}
+	for (int i = 0; i < stackSize; ++i)
+	{
+		h ^= hashSlot(stackSlot + i, stack[i]);
+	}
+	for (int i = 0; i < screenSize; ++i)
+	{
+		h ^= hashSlot(gfxSlot + i, gfx[i]);
+	}
+
+	return h ^ scalarHash();
+}
+
+//----------------------------------------------------------------------------
+// scalarHash - pc, I, sp and the timers change nearly every tick so it's
+// cheaper to hash them on demand than to track them
+//----------------------------------------------------------------------------
+unsigned long long Chip8::scalarHash()
+{
+	return hashSlot(scalarSlot, pc)
+		^ hashSlot(scalarSlot + 1, I)
+		^ hashSlot(scalarSlot + 2, sp)
+		^ hashSlot(scalarSlot + 3, delayTimer)
+		^ hashSlot(scalarSlot + 4, soundTimer)
+		^ hashSlot(scalarSlot + 5, randomState);
+}
+
+//----------------------------------------------------------------------------
+// rehash - recalculate the incremental hashes after a bulk write
+// (reset, load etc.)
+//----------------------------------------------------------------------------
+void Chip8::rehash()
+{
+	dataHash = 0;
+	screenHash = 0;
+
+	for (int i = 0; i < memorySize; ++i)
+	{
+		dataHash ^= hashSlot(memorySlot + i, memory[i]);
+	}
+	for (int i = 0; i < numRegs; ++i)
+	{
+		dataHash ^= hashSlot(regsSlot + i, regs[i]);
+	}
+	for (int i = 0; i < stackSize; ++i)
+	{
+		dataHash ^= hashSlot(stackSlot + i, stack[i]);
+	}
+	for (int i = 0; i < screenSize; ++i)
+	{
+		screenHash ^= hashSlot(gfxSlot + i, gfx[i]);
+	}
+}
+
+//----------------------------------------------------------------------------
+// hashSlot - the random number for a value stored in a given slot. Zero
+// always hashes to zero so a cleared array contributes nothing.
+// (splitmix64 finalizer, so we don't need a 4096 * 256 table)
+//----------------------------------------------------------------------------
+unsigned long long Chip8::hashSlot(unsigned int slot, unsigned int value)
+{
+	if (value == 0)
+	{
+		return 0;
+	}
+
+	unsigned long long z = ((unsigned long long)slot << 32 | value) * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+//----------------------------------------------------------------------------
+// writeReg
+//----------------------------------------------------------------------------
+void Chip8::writeReg(int reg, unsigned char value)
+{
+	dataHash ^= hashSlot(regsSlot + reg, regs[reg]) ^ hashSlot(regsSlot + reg, value);
+	regs[reg] = value;
+}
+
+//----------------------------------------------------------------------------
+// writeMemory
+//----------------------------------------------------------------------------
+void Chip8::writeMemory(unsigned short address, unsigned char value)
+{
+	dataHash ^= hashSlot(memorySlot + address, memory[address]) ^ hashSlot(memorySlot + address, value);
+	memory[address] = value;
+}
+
+//----------------------------------------------------------------------------
+// writeStack
+//----------------------------------------------------------------------------
+void Chip8::writeStack(int index, unsigned short value)
+{
+	dataHash ^= hashSlot(stackSlot + index, stack[index]) ^ hashSlot(stackSlot + index, value);
+	stack[index] = value;
+}
+
+//----------------------------------------------------------------------------
+// flipPixel - xor a pixel, returns true if it was set (a collision)
+// sprites that run off the bottom of the screen are clipped
+//----------------------------------------------------------------------------
+bool Chip8::flipPixel(int index)
+{
+	if (index >= screenSize)
+	{
+		return false;
+	}
+
+	bool collision = gfx[index] == 1;
+	screenHash ^= hashSlot(gfxSlot + index, 1);
+	gfx[index] ^= 1;
+	screenChanged();
+	return collision;
+}
+
+//----------------------------------------------------------------------------
+// readKey - read a key for EX9E/EXA1/FX0A. Only the low nibble of the key
+// is used, as on the original interpreter. Seeing a stamped key down is
+// what changes the ROM's path (EX9E skips, EXA1 doesn't, FX0A completes),
+// so that arms the stamp for the next screen change (see latencyTimes)
+//----------------------------------------------------------------------------
+unsigned char Chip8::readKey(int key)
+{
+	key &= 0xf;
+	if (keys[key] != 0 && keyTimes[key] != 0)
+	{
+		inputTimes[key] = keyTimes[key];
+		inputPending = true;
+		keyTimes[key] = 0;
+	}
+	return keys[key];
+}
+
+//----------------------------------------------------------------------------
+// screenChanged
+//----------------------------------------------------------------------------
+void Chip8::screenChanged()
+{
+	if (inputPending)
+	{
+		for (int i = 0; i < numKeys; i++)
+		{
+			if (inputTimes[i] != 0)
+			{
+				latencyTimes[i] = inputTimes[i];
+				inputTimes[i] = 0;
+			}
+		}
+		inputPending = false;
+		latencyPending = true;
+	}
+}
+
 //----------------------------------------------------------------------------
 // decodeAndExecute
 //----------------------------------------------------------------------------
@@ -135,6 +346,8 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 				case 0x0000:
 					//00E0    disp_clear()    Clears the screen.
 					memset(gfx, 0, screenSize);
+					screenHash = 0;
+					screenChanged();
 					drawFlag = true;
 					pc += 2;
 				break;
@@ -157,7 +370,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			break;
 		case 0x2000:
 			//2NNN	Flow	*(0xNNN)()	Calls subroutine at NNN.
-			stack[sp++] = pc;
+			writeStack(sp++, pc);
 			pc = opcode & 0x0fff;
 			break;	
 		case 0x3000:
@@ -195,12 +408,12 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			break;
 		case 0x6000:
 			// set Vx to NN
-			regs[(opcode & 0x0f00) >> 8] = opcode & 0x00ff;
+			writeReg((opcode & 0x0f00) >> 8, opcode & 0x00ff);
 			pc += 2;
 			break;
 		case 0x7000:
 			// add NN to Vx
-			regs[(opcode & 0x0f00) >> 8] += opcode & 0x00ff;
+			writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] + (opcode & 0x00ff));
 			pc += 2;
 			break;
 		case 0x8000:
@@ -208,73 +421,73 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			{
 				case 0x0000:
 					//	Vx = Vy	
-					regs[(opcode & 0x0f00) >> 8] = regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0001:
 					// Vx = Vx | Vy	
-					regs[(opcode & 0x0f00) >> 8] |= regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] | regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0002:
 					// Vx = Vx & Vy	
-					regs[(opcode & 0x0f00) >> 8] &= regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] & regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0003:
 					// Vx = Vx^Vy
-					regs[(opcode & 0x0f00) >> 8] ^= regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] ^ regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0004:
 					// Vx += Vy 	Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
 					if (regs[(opcode & 0x00f0) >> 4] > (0xFF - regs[(opcode & 0x0f00) >> 8]))
 					{
-						regs[0xf] = 1; //carry
+						writeReg(0xf, 1); //carry
 					}
 					else
 					{
-						regs[0xf] = 0;
+						writeReg(0xf, 0);
 					}
-					regs[(opcode & 0x0f00) >> 8] += regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] + regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0005:
 					//Vx -= Vy	VY is subtracted from VX.VF is set to 0 when there's a borrow, and 1 when there isn't.
 					if (regs[(opcode & 0x00f0) >> 4] > regs[(opcode & 0x0f00) >> 8])
 					{
-						regs[0xf] = 0; //borrow
+						writeReg(0xf, 0); //borrow
 					}
 					else
 					{
-						regs[0xf] = 1;
+						writeReg(0xf, 1);
 					}
-					regs[(opcode & 0x0f00) >> 8] -= regs[(opcode & 0x00f0) >> 4];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] - regs[(opcode & 0x00f0) >> 4]);
 					pc += 2;
 					break;
 				case 0x0006:
 					// Vx >>= 1	Stores the least significant bit of VX in VF and then shifts VX to the right by 1
-					regs[0xf] = regs[(opcode & 0x0f00) >> 8] & 0x1;
-					regs[(opcode & 0x0f00) >> 8] >>= 1;
+					writeReg(0xf, regs[(opcode & 0x0f00) >> 8] & 0x1);
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] >> 1);
 					pc += 2;
 					break;
 				case 0x0007:
 					//Vx = Vy - Vx	Sets VX to VY minus VX.VF is set to 0 when there's a borrow, and 1 when there isn't.
 					if (regs[(opcode & 0x0f00) >> 8] > regs[(opcode & 0x00f0) >> 4])
 					{
-						regs[0xf] = 0; //borrow
+						writeReg(0xf, 0); //borrow
 					}
 					else
 					{
-						regs[0xf] = 1;
+						writeReg(0xf, 1);
 					}
-					regs[(opcode & 0x0f00) >> 8] = regs[(opcode & 0x00f0) >> 4] - regs[(opcode & 0x0f00) >> 8];
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x00f0) >> 4] - regs[(opcode & 0x0f00) >> 8]);
 					pc += 2;
 					break;
 				case 0x000e:
 					// Vx <<= 1	Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-					regs[0xf] = regs[(opcode & 0x0f00) >> 8] >> 7;
-					regs[(opcode & 0x0f00) >> 8] <<= 1;
+					writeReg(0xf, regs[(opcode & 0x0f00) >> 8] >> 7);
+					writeReg((opcode & 0x0f00) >> 8, regs[(opcode & 0x0f00) >> 8] << 1);
 					pc += 2;
 					break;
 				default:
@@ -304,7 +517,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			break;
 		case 0xc000:
 			// Vx=rand()&NN	Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
-			regs[(opcode & 0x0f00) >> 8] = (rand() % 255) & (opcode & 0x00ff);
+			writeReg((opcode & 0x0f00) >> 8, (random() % 255) & (opcode & 0x00ff));
 			pc += 2;
 			break;
 		case 0xd000:
@@ -314,7 +527,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			unsigned short y = regs[(opcode & 0x00f0) >> 4];
 			unsigned short height = opcode & 0x000f;
 			
-			regs[0xF] = 0;
+			writeReg(0xF, 0);
 			for (int yLine = 0; yLine < height; yLine++)
 			{
 				unsigned short pixel = memory[I + yLine];
@@ -322,16 +535,16 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 				{
 					if ((pixel & (0x80 >> xLine)) != 0)
 					{
-						if (gfx[(x + xLine + ((y + yLine) * 64))] == 1)
+						if (flipPixel(x + xLine + ((y + yLine) * 64)))
 						{
-							regs[0xF] = 1;
+							writeReg(0xF, 1);
 						}
-						gfx[x + xLine + ((y + yLine) * 64)] ^= 1;
 					}
 				}
 			}
 
 			drawFlag = true;
+			drawCount++;
 			pc += 2;
 		}
 			break;
@@ -340,7 +553,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			{
 				case 0x009e:
 				// if (key() == Vx)	Skips the next instruction if the key stored in VX is pressed.
-					if (keys[regs[(opcode & 0x0f00) >> 8]] == 1)
+					if (readKey(regs[(opcode & 0x0f00) >> 8]) == 1)
 					{
 						pc += 4;
 					}
@@ -351,7 +564,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 					break;
 				case 0x00a1:
 				// if(key()!=Vx)	Skips the next instruction if the key stored in VX isn't pressed.
-					if (keys[regs[(opcode & 0x0f00) >> 8]] == 0)
+					if (readKey(regs[(opcode & 0x0f00) >> 8]) == 0)
 					{
 						pc += 4;
 					}
@@ -370,7 +583,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 			{
 				case 0x0007:
 					// Vx = get_delay()	Sets VX to the value of the delay time
-					regs[(opcode & 0x0f00) >> 8] = delayTimer;
+					writeReg((opcode & 0x0f00) >> 8, delayTimer);
 					pc += 2;
 					break;
 				case 0x000a:
@@ -379,9 +592,9 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 					bool keyPress = false;
 					for (int i = 0; i < 16; ++i)
 					{
-						if (keys[i] != 0)
+						if (readKey(i) != 0)
 						{
-							regs[(opcode & 0x0f00) >> 8] = i;
+							writeReg((opcode & 0x0f00) >> 8, i);
 							keyPress = true;
 						}
 					}
@@ -407,11 +620,11 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 					// VF is set to 1 when range overflow (I+VX > 0xFFF), and 0 when there isn't.
 					if (I + regs[(opcode & 0x0f00) >> 8] > 0xFFF)
 					{
-						regs[0xF] = 1;
+						writeReg(0xF, 1);
 					}
 					else
 					{
-						regs[0xF] = 0;
+						writeReg(0xF, 0);
 					}
 					I += regs[(opcode & 0x0f00) >> 8];
 					pc += 2;
@@ -423,16 +636,16 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 					break;
 				case 0x0033:
 					// bcd
-					memory[I] = regs[(opcode & 0x0f00) >> 8] / 100;
-					memory[I + 1] = (regs[(opcode & 0x0f00) >> 8] / 10) % 10;
-					memory[I + 2] = (regs[(opcode & 0x0f00) >> 8] % 100) % 10;
+					writeMemory(I, regs[(opcode & 0x0f00) >> 8] / 100);
+					writeMemory(I + 1, (regs[(opcode & 0x0f00) >> 8] / 10) % 10);
+					writeMemory(I + 2, (regs[(opcode & 0x0f00) >> 8] % 100) % 10);
 					pc += 2;
 					break;
 				case 0x0055:
 					// reg_dump(Vx,&I)	Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
 					for (int j = 0; j <= ((opcode & 0x0f00) >> 8); j++)
 					{
-						memory[I + j] = regs[j];
+						writeMemory(I + j, regs[j]);
 					}
 
 					// On the original interpreter, when the operation is done, I = I + X + 1.
@@ -443,7 +656,7 @@ void Chip8::decodeAndExecute(unsigned short opcode)
 					// reg_load(Vx,&I)	Fills V0 to VX (including VX) with values from memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
 					for (int j = 0; j <= ((opcode & 0x0f00) >> 8); j++)
 					{
-						regs[j] = memory[I + j];
+						writeReg(j, memory[I + j]);
 					}
 
 					// On the original interpreter I = I + X + 1.
@@ -19,6 +19,14 @@ public:
 	static const int numRegs = 16;
 	static const int stackSize = 16;
 
+	// hash slots - each byte/word of state gets its own range of
+	// random numbers in the state hash
+	static const unsigned int memorySlot = 0;
+	static const unsigned int regsSlot = memorySlot + memorySize;
+	static const unsigned int stackSlot = regsSlot + numRegs;
+	static const unsigned int gfxSlot = stackSlot + stackSize;
+	static const unsigned int scalarSlot = gfxSlot + screenSize;
+
 	unsigned short currentOpcode;
 
 	// memory map
@@ -31,6 +39,17 @@ public:
 
 	unsigned char keys[numKeys];
 
+	// input latency tracking, per key. The host stamps keyTimes when a key
+	// goes down and clears it when the key comes up. A read that sees the
+	// key down moves the stamp to inputTimes, and the first screen change
+	// after that moves it to latencyTimes for the host to pick up when the
+	// frame is presented. 0 means nothing pending. Units are up to the host.
+	unsigned long long keyTimes[numKeys];
+	unsigned long long inputTimes[numKeys];
+	unsigned long long latencyTimes[numKeys];
+	bool inputPending;
+	bool latencyPending;
+
 	enum KeyStatus
 	{
 		key_up,
@@ -64,11 +83,21 @@ public:
 	unsigned char delayTimer;
 	unsigned char soundTimer;
 
+	unsigned int randomState;
+
+	// for telemetry
+	unsigned long long instructionCount;
+	unsigned long long drawCount;
+
 	unsigned short stack[stackSize];
 	unsigned short sp;
 	bool drawFlag;
 	bool beepFlag;
 
+	// incremental state hashes, see stateHash()
+	unsigned long long dataHash;	// memory, regs and stack
+	unsigned long long screenHash;	// gfx
+
 	Chip8() {};
 	~Chip8() {};
 
@@ -80,4 +109,22 @@ public:
 
 	void decodeAndExecute(unsigned short opcode);
 	void updateTimers();
+
+	void seedRandom(unsigned int seed);
+	unsigned int random();
+
+	unsigned long long stateHash();
+	unsigned long long computeStateHash();
+	unsigned long long scalarHash();
+	void rehash();
+	static unsigned long long hashSlot(unsigned int slot, unsigned int value);
+
+	// all writes to hashed state go through these
+	void writeReg(int reg, unsigned char value);
+	void writeMemory(unsigned short address, unsigned char value);
+	void writeStack(int index, unsigned short value);
+	bool flipPixel(int index);
+
+	unsigned char readKey(int key);
+	void screenChanged();
 };
\ No newline at end of file
@@ -0,0 +1,355 @@
+//----------------------------------------------------------------------------
+// explorer.cpp
+//----------------------------------------------------------------------------
+
+#include "explorer.h"
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+//----------------------------------------------------------------------------
+// Explorer
+//----------------------------------------------------------------------------
+Explorer::Explorer(int ticksPerFrame, int framesPerInput)
+	: romBytes(0), ticksPerFrame(ticksPerFrame), framesPerInput(framesPerInput)
+{
+	for (int i = 0; i < Chip8::memorySize / 32; i++)
+	{
+		coverageMap[i] = 0;
+	}
+	rom.reset();
+}
+
+//----------------------------------------------------------------------------
+// load
+//----------------------------------------------------------------------------
+bool Explorer::load(std::string filename)
+{
+	rom.reset();
+	if (!rom.load(filename))
+	{
+		return false;
+	}
+
+	std::ifstream romFile(filename, std::ios::binary | std::ios::ate);
+	romBytes = (int)romFile.tellg();
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// run - explore numInputs inputs spread over numThreads threads
+//----------------------------------------------------------------------------
+void Explorer::run(int numThreads, int numInputs)
+{
+	inputsLeft = numInputs;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; i++)
+	{
+		threads.push_back(std::thread(&Explorer::worker, this, 1234 + i));
+	}
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+//----------------------------------------------------------------------------
+// worker - pick something from the corpus, mutate it, and see if it
+// gets us anywhere new
+//----------------------------------------------------------------------------
+void Explorer::worker(unsigned int threadSeed)
+{
+	std::mt19937 rng(threadSeed);
+	std::vector<unsigned long long> screens;
+
+	while (inputsLeft-- > 0)
+	{
+		Input input;
+		input.seed = rng();
+
+		{
+			std::lock_guard<std::mutex> lock(corpusMutex);
+			if (!corpus.empty() && rng() % 8 != 0)
+			{
+				input = corpus[rng() % corpus.size()];
+			}
+		}
+
+		if (input.keyFrames.empty())
+		{
+			// start from nothing pressed
+			input.keyFrames.assign(framesPerInput, 0);
+		}
+
+		// mutations - new seed, hold/release a key for a run of frames,
+		// or mash random keys
+		int numMutations = 1 + rng() % 4;
+		for (int m = 0; m < numMutations; m++)
+		{
+			int start = rng() % framesPerInput;
+			int length = 1 + rng() % 60;
+			unsigned short key = 1 << (rng() % Chip8::numKeys);
+
+			switch (rng() % 4)
+			{
+				case 0:
+					input.seed = rng();
+					break;
+				case 1:
+					for (int f = start; f < start + length && f < framesPerInput; f++)
+					{
+						input.keyFrames[f] |= key;
+					}
+					break;
+				case 2:
+					for (int f = start; f < start + length && f < framesPerInput; f++)
+					{
+						input.keyFrames[f] &= ~key;
+					}
+					break;
+				case 3:
+					for (int f = start; f < start + length && f < framesPerInput; f++)
+					{
+						input.keyFrames[f] = rng() & 0xffff;
+					}
+					break;
+			}
+		}
+
+		screens.clear();
+		execute(&input, &screens);
+		if (merge(&input, &screens))
+		{
+			std::lock_guard<std::mutex> lock(corpusMutex);
+			corpus.push_back(input);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// execute - run an input from power on, recording the PCs we hit and
+// the hash of every screen drawn
+//----------------------------------------------------------------------------
+void Explorer::execute(Input *input, std::vector<unsigned long long> *screens)
+{
+	Chip8 theChip8 = rom;
+	theChip8.seedRandom(input->seed);
+	input->coverage.reset();
+
+	for (size_t f = 0; f < input->keyFrames.size(); f++)
+	{
+		for (int k = 0; k < Chip8::numKeys; k++)
+		{
+			theChip8.keys[k] = (input->keyFrames[f] >> k) & 1;
+		}
+
+		for (int i = 0; i < ticksPerFrame; i++)
+		{
+			input->coverage.set(theChip8.pc & 0xfff);
+			theChip8.tick();
+		}
+		theChip8.updateTimers();
+
+		if (theChip8.willDraw())
+		{
+			screens->push_back(theChip8.screenHash);
+			theChip8.drawFlag = false;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// merge - add a run's coverage to the shared map, true if it found
+// anything new
+//----------------------------------------------------------------------------
+bool Explorer::merge(Input *input, std::vector<unsigned long long> *screens)
+{
+	bool found = false;
+
+	for (int i = 0; i < Chip8::memorySize / 32; i++)
+	{
+		unsigned int bits = 0;
+		for (int b = 0; b < 32; b++)
+		{
+			if (input->coverage[i * 32 + b])
+			{
+				bits |= 1u << b;
+			}
+		}
+
+		if (bits != 0 && (bits & ~coverageMap[i].fetch_or(bits)) != 0)
+		{
+			found = true;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(corpusMutex);
+	for (size_t i = 0; i < screens->size(); i++)
+	{
+		if (seenScreens.insert((*screens)[i]))
+		{
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+//----------------------------------------------------------------------------
+// minimize - greedily keep the inputs that add the most PC coverage until
+// the corpus covers everything the whole corpus did
+//----------------------------------------------------------------------------
+void Explorer::minimize()
+{
+	std::vector<Input> minimized;
+	Coverage covered;
+	Coverage total;
+
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		total |= corpus[i].coverage;
+	}
+
+	while (covered != total)
+	{
+		size_t best = 0;
+		size_t bestGain = 0;
+		for (size_t i = 0; i < corpus.size(); i++)
+		{
+			size_t gain = (corpus[i].coverage & ~covered).count();
+			if (gain > bestGain)
+			{
+				best = i;
+				bestGain = gain;
+			}
+		}
+
+		covered |= corpus[best].coverage;
+		minimized.push_back(corpus[best]);
+	}
+
+	corpus = minimized;
+}
+
+//----------------------------------------------------------------------------
+// saveCorpus - one input per line: the seed, then the key mask for each
+// frame, all in hex
+//----------------------------------------------------------------------------
+bool Explorer::saveCorpus(std::string filename)
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write corpus file " << filename << std::endl;
+		return false;
+	}
+
+	file << std::hex;
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		file << corpus[i].seed;
+		for (size_t f = 0; f < corpus[i].keyFrames.size(); f++)
+		{
+			file << " " << corpus[i].keyFrames[f];
+		}
+		file << std::endl;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// loadCorpus - read back a file written by saveCorpus
+//----------------------------------------------------------------------------
+bool Explorer::loadCorpus(std::string filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "Could not read corpus file " << filename << std::endl;
+		return false;
+	}
+
+	corpus.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream fields(line);
+		Input input;
+		unsigned int keys;
+
+		if (!(fields >> std::hex >> input.seed))
+		{
+			continue;
+		}
+		while (fields >> keys)
+		{
+			input.keyFrames.push_back((unsigned short)keys);
+		}
+		corpus.push_back(input);
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// replay - run the corpus again from scratch, so coveredBytes() reports
+// what it reaches on its own
+//----------------------------------------------------------------------------
+void Explorer::replay()
+{
+	for (int i = 0; i < Chip8::memorySize / 32; i++)
+	{
+		coverageMap[i] = 0;
+	}
+	seenScreens.clear();
+
+	std::vector<unsigned long long> screens;
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		screens.clear();
+		execute(&corpus[i], &screens);
+		merge(&corpus[i], &screens);
+	}
+}
+
+//----------------------------------------------------------------------------
+// romSize
+//----------------------------------------------------------------------------
+int Explorer::romSize()
+{
+	return romBytes;
+}
+
+//----------------------------------------------------------------------------
+// coveredBytes - bytes of the ROM that have been executed. Each PC we hit
+// covers both bytes of its instruction
+//----------------------------------------------------------------------------
+int Explorer::coveredBytes()
+{
+	int total = 0;
+	for (int a = Chip8::progBase; a < Chip8::progBase + romBytes; a++)
+	{
+		unsigned int here = coverageMap[a / 32].load() >> (a % 32) & 1;
+		unsigned int before = coverageMap[(a - 1) / 32].load() >> ((a - 1) % 32) & 1;
+		if (here || before)
+		{
+			total++;
+		}
+	}
+	return total;
+}
+
+//----------------------------------------------------------------------------
+// coveragePercent - data in the ROM is never executed, so this won't
+// reach 100%
+//----------------------------------------------------------------------------
+double Explorer::coveragePercent()
+{
+	if (romBytes == 0)
+	{
+		return 0.0;
+	}
+	return 100.0 * coveredBytes() / romBytes;
+}
@@ -0,0 +1,60 @@
+#pragma once
+//----------------------------------------------------------------------------
+// explorer.h
+// Coverage guided input explorer. Runs lots of headless Chip8s with
+// mutated keypad input and CXNN seeds, keeping any input that reaches a
+// new PC or draws a screen we haven't seen before.
+//----------------------------------------------------------------------------
+
+#include <atomic>
+#include <bitset>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "statetable.h"
+
+class Explorer {
+public:
+	typedef std::bitset<Chip8::memorySize> Coverage;
+
+	// one input: a CXNN seed and the keys held down on each frame
+	struct Input
+	{
+		unsigned int seed;
+		std::vector<unsigned short> keyFrames;
+		Coverage coverage;
+	};
+
+	std::vector<Input> corpus;
+
+	Explorer(int ticksPerFrame, int framesPerInput);
+	~Explorer() {};
+
+	bool load(std::string filename);
+	void run(int numThreads, int numInputs);
+	void minimize();
+	bool saveCorpus(std::string filename);
+	bool loadCorpus(std::string filename);
+	void replay();
+
+	int romSize();
+	int coveredBytes();
+	double coveragePercent();
+
+private:
+	Chip8 rom;		// freshly loaded machine we copy for each run
+	int romBytes;
+	int ticksPerFrame;
+	int framesPerInput;
+
+	// shared between threads
+	std::atomic<unsigned int> coverageMap[Chip8::memorySize / 32];
+	std::atomic<int> inputsLeft;
+	std::mutex corpusMutex;
+	StateTable seenScreens;		// screenHash of every screen drawn
+
+	void worker(unsigned int threadSeed);
+	void execute(Input *input, std::vector<unsigned long long> *screens);
+	bool merge(Input *input, std::vector<unsigned long long> *screens);
+};
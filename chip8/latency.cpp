@@ -0,0 +1,88 @@
+//----------------------------------------------------------------------------
+// latency.cpp
+//----------------------------------------------------------------------------
+
+#include "latency.h"
+#include <algorithm>
+#include <string>
+
+//----------------------------------------------------------------------------
+// LatencyHistogram
+//----------------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram()
+	: buckets(numBuckets, 0)
+{
+}
+
+//----------------------------------------------------------------------------
+// add
+//----------------------------------------------------------------------------
+void LatencyHistogram::add(double ms)
+{
+	int bucket = (int)ms;
+	if (bucket < 0)
+	{
+		bucket = 0;
+	}
+	if (bucket >= numBuckets)
+	{
+		bucket = numBuckets - 1;
+	}
+
+	buckets[bucket]++;
+	samples.push_back(ms);
+}
+
+//----------------------------------------------------------------------------
+// count
+//----------------------------------------------------------------------------
+int LatencyHistogram::count()
+{
+	return (int)samples.size();
+}
+
+//----------------------------------------------------------------------------
+// percentile - p from 0 to 100
+//----------------------------------------------------------------------------
+double LatencyHistogram::percentile(double p)
+{
+	if (samples.empty())
+	{
+		return 0.0;
+	}
+
+	std::vector<double> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+
+	size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[index];
+}
+
+//----------------------------------------------------------------------------
+// print - one line per non-empty bucket with a bar, then the percentiles
+//----------------------------------------------------------------------------
+void LatencyHistogram::print(std::ostream &out)
+{
+	out << "Input latency, " << count() << " events" << std::endl;
+	if (samples.empty())
+	{
+		return;
+	}
+
+	int biggest = *std::max_element(buckets.begin(), buckets.end());
+	for (int i = 0; i < numBuckets; i++)
+	{
+		if (buckets[i] == 0)
+		{
+			continue;
+		}
+
+		out << (i < 10 ? " " : "") << i << (i == numBuckets - 1 ? "+" : " ")
+			<< "ms " << std::string(1 + buckets[i] * 50 / biggest, '#')
+			<< " " << buckets[i] << std::endl;
+	}
+
+	out << "min " << percentile(0) << "ms, median " << percentile(50)
+		<< "ms, p90 " << percentile(90) << "ms, p99 " << percentile(99)
+		<< "ms, max " << percentile(100) << "ms" << std::endl;
+}
@@ -0,0 +1,26 @@
+#pragma once
+//----------------------------------------------------------------------------
+// latency.h
+// Histogram of input to display latency, key event to the frame that
+// first showed its effect
+//----------------------------------------------------------------------------
+
+#include <ostream>
+#include <vector>
+
+class LatencyHistogram {
+public:
+	static const int numBuckets = 100;	// 1ms each, last one is 99ms+
+
+	LatencyHistogram();
+	~LatencyHistogram() {};
+
+	void add(double ms);
+	int count();
+	double percentile(double p);
+	void print(std::ostream &out);
+
+private:
+	std::vector<int> buckets;
+	std::vector<double> samples;
+};
@@ -1,6 +1,17 @@
+#include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <SDL.h>
 #include "chip8.h"
+#include "explorer.h"
+#include "latency.h"
+#include "memsearch.h"
+#include "recompiler.h"
+#include "telemetry.h"
 
 //----------------------------------------------------------------------------
 // Chip8 main.cpp 2018 Richard Dare - www.richardjdare.com
@@ -22,14 +33,85 @@ const int pixelHeight = screenHeight / Chip8::screenHeight;
 // prototypes
 //----------------------------------------------------------------------------
 void render(Chip8 *theChip8, SDL_Renderer *renderer);
-void updateKey(Chip8 *theChip8, SDL_Keycode sdlKeycode, Chip8::KeyStatus keyStatus);
+void updateKey(Chip8 *theChip8, SDL_Keycode sdlKeycode, Chip8::KeyStatus keyStatus, Uint64 eventTime);
+void pushSyntheticKeys(int frame);
 void drawPixel(SDL_Renderer *renderer, int x, int y, int width, int height);
+int exploreRoms(std::string romDir, bool replay);
+int searchRam(std::string romFilename);
+int checkHashes(std::string romDir);
+int recompileRom(std::string romFilename, std::string outFilename);
+#ifdef CHIP8_RECOMPILED
+int benchmarkRecompiled(int frames);
+#endif
 
 //----------------------------------------------------------------------------
 // main
 //----------------------------------------------------------------------------
 int main(int argc, char * argv[])
 {
+	// chip8 --explore [--replay] [romdir] runs the coverage explorer headless,
+	// or replays the corpus it saved last time
+	if (argc > 1 && string(argv[1]) == "--explore")
+	{
+		bool replay = argc > 2 && string(argv[2]) == "--replay";
+		int dirArg = replay ? 3 : 2;
+		return exploreRoms(argc > dirArg ? argv[dirArg] : "../chip8/roms", replay);
+	}
+
+	// chip8 --ramsearch rom finds addresses (score, lives) to watch
+	if (argc > 2 && string(argv[1]) == "--ramsearch")
+	{
+		return searchRam(argv[2]);
+	}
+
+	// chip8 --checkhash [romdir] checks the incremental state hash
+	if (argc > 1 && string(argv[1]) == "--checkhash")
+	{
+		return checkHashes(argc > 2 ? argv[2] : "../chip8/roms");
+	}
+
+	// chip8 --recompile rom [out.cpp] writes a ROM specific C++ file
+	if (argc > 2 && string(argv[1]) == "--recompile")
+	{
+		return recompileRom(argv[2], argc > 3 ? argv[3] : "recompiled_rom.cpp");
+	}
+
+#ifdef CHIP8_RECOMPILED
+	// chip8 --benchmark [frames] times the recompiled ROM against the interpreter
+	if (argc > 1 && string(argv[1]) == "--benchmark")
+	{
+		return benchmarkRecompiled(argc > 2 ? atoi(argv[2]) : 100000);
+	}
+#endif
+
+	// chip8 --latency [frames] [rom] runs headless on SDL's dummy drivers,
+	// feeding in key presses and printing an input latency histogram
+	string romFilename = "../chip8/roms/invaders.rom";
+	bool latencyMode = false;
+	int latencyFrames = 0;
+	if (argc > 1 && string(argv[1]) == "--latency")
+	{
+		latencyMode = true;
+		latencyFrames = argc > 2 ? atoi(argv[2]) : 60 * framerate;
+		if (argc > 3)
+		{
+			romFilename = argv[3];
+		}
+
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+	}
+
+	// chip8 --telemetry [port] publishes runtime metrics to chip8.stats
+	// and http://127.0.0.1:port/metrics
+	Telemetry telemetry;
+	Telemetry::Counters *counters = nullptr;
+	if (argc > 1 && string(argv[1]) == "--telemetry")
+	{
+		telemetry.start(argc > 2 ? atoi(argv[2]) : 9108, "chip8.stats", 1000);
+		counters = telemetry.addInstance("main", clockSpeedHz);
+	}
+
 	if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
 	{
 		cout << "SDL initialization failed. SDL Error: " << SDL_GetError() << endl;
@@ -47,8 +129,9 @@ int main(int argc, char * argv[])
 		cout << "Could not initialize window" << endl;
 	}
 
+	// the dummy video driver only has a software renderer
 	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 
-		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+		latencyMode ? 0 : SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 
 	if (renderer == nullptr)
 	{
@@ -73,12 +156,31 @@ int main(int argc, char * argv[])
 	Chip8 myChip8 = Chip8();
 
 	myChip8.reset();
-	myChip8.load("../chip8/roms/invaders.rom");
+#ifdef CHIP8_RECOMPILED
+	loadRecompiledRom(&myChip8);
+	romFilename = recompiledRomName;	// so <rom>.watch is looked for in the working directory
+#else
+	myChip8.load(romFilename);
+#endif
+
+	// addresses found with --ramsearch, printed whenever they change
+	WatchList watchList;
+	std::vector<unsigned char> watchValues;
+	if (watchList.load(WatchList::filenameForRom(romFilename)))
+	{
+		cout << "Watching " << watchList.watches.size() << " addresses" << endl;
+	}
+	watchValues.assign(watchList.watches.size(), 0);
 
 	bool quit = false;
 	SDL_Event e;
 
+	LatencyHistogram latency;
+	double countsPerMs = SDL_GetPerformanceFrequency() / 1000.0;
+	int frame = 0;
+
 	Uint32 lastTime = SDL_GetTicks();
+	Uint64 lastFrameCount = SDL_GetPerformanceCounter();
 
 	while (!quit)
 	{
@@ -89,33 +191,65 @@ int main(int argc, char * argv[])
 		Uint32 startTime = SDL_GetTicks();
 		Uint32 frametime = startTime - lastTime;
 
+		// SDL_GetTicks is only good to a millisecond, too coarse for
+		// telemetry's frame time percentiles
+		Uint64 frameCount = SDL_GetPerformanceCounter();
+		double frameMs = (frameCount - lastFrameCount) / countsPerMs;
+		lastFrameCount = frameCount;
+
+		if (latencyMode)
+		{
+			pushSyntheticKeys(frame);
+			if (++frame >= latencyFrames)
+			{
+				quit = true;
+			}
+		}
+
 		// process sdl events
 		while (SDL_PollEvent(&e) != 0)
 		{
+			Uint64 eventTime = SDL_GetPerformanceCounter();
+
 			if (e.type == SDL_QUIT)
 			{
 				quit = true;
 			}
-			if (e.type == SDL_KEYDOWN)
+			// repeats aren't new presses, they'd restart the latency clock
+			if (e.type == SDL_KEYDOWN && e.key.repeat == 0)
 			{
-				updateKey(&myChip8, e.key.keysym.sym, Chip8::key_down);
+				updateKey(&myChip8, e.key.keysym.sym, Chip8::key_down, eventTime);
 			}
 			if (e.type == SDL_KEYUP)
 			{
-				updateKey(&myChip8, e.key.keysym.sym, Chip8::key_up);
+				updateKey(&myChip8, e.key.keysym.sym, Chip8::key_up, eventTime);
 			}
 		}
 
 		// we want to run at 500hz, so perform as many ticks as
 		// necessary given the current framerate
+#ifdef CHIP8_RECOMPILED
+		runRecompiled(&myChip8, ticksPerFrame);
+#else
 		for (int i = 0; i < ticksPerFrame; i++)
 		{
 			myChip8.tick();
 		}
+#endif
 
 		// timers run at 60hz
 		myChip8.updateTimers();
 
+		for (size_t i = 0; i < watchList.watches.size(); i++)
+		{
+			unsigned char value = watchList.read(&myChip8, (int)i);
+			if (value != watchValues[i])
+			{
+				cout << watchList.watches[i].name << ": " << (int)value << endl;
+				watchValues[i] = value;
+			}
+		}
+
 		// is it time to update the screen?
 		// We only draw when Chip8 tells us to
 		if (myChip8.willDraw())
@@ -144,8 +278,32 @@ int main(int argc, char * argv[])
 		lastTime = startTime;
 
 		SDL_RenderPresent(renderer);
+
+		Telemetry::recordFrame(counters, &myChip8, frameMs, 1000.0 / framerate);
+
+		// did this frame show the result of a key press?
+		if (myChip8.latencyPending)
+		{
+			Uint64 presentTime = SDL_GetPerformanceCounter();
+			for (int i = 0; i < Chip8::numKeys; i++)
+			{
+				if (myChip8.latencyTimes[i] != 0)
+				{
+					latency.add((presentTime - myChip8.latencyTimes[i]) / countsPerMs);
+					myChip8.latencyTimes[i] = 0;
+				}
+			}
+			myChip8.latencyPending = false;
+		}
 	}
 
+	if (latencyMode)
+	{
+		latency.print(cout);
+	}
+
+	telemetry.stop();
+
 	SDL_CloseAudioDevice(deviceId);
 	SDL_FreeWAV(wavBuffer);
 	SDL_DestroyRenderer(renderer);
@@ -190,57 +348,426 @@ void render(Chip8 *theChip8, SDL_Renderer *renderer)
 //----------------------------------------------------------------------------
 // updateKey
 //----------------------------------------------------------------------------
-void updateKey(Chip8 *theChip8, SDL_Keycode sdlKeycode, Chip8::KeyStatus keyStatus)
+void updateKey(Chip8 *theChip8, SDL_Keycode sdlKeycode, Chip8::KeyStatus keyStatus, Uint64 eventTime)
 {
+	int key = -1;
+
 	switch (sdlKeycode) 
 	{
 	case SDLK_1:
-		theChip8->keys[0] = keyStatus;
+		key = 0;
 		break;
 	case SDLK_2:
-		theChip8->keys[1] = keyStatus;
+		key = 1;
 		break;
 	case SDLK_3:
-		theChip8->keys[2] = keyStatus;
+		key = 2;
 		break;
 	case SDLK_4:
-		theChip8->keys[3] = keyStatus;
+		key = 3;
 		break;
 	case SDLK_q:
-		theChip8->keys[4] = keyStatus;
+		key = 4;
 		break;
 	case SDLK_w:
-		theChip8->keys[5] = keyStatus;
+		key = 5;
 		break;
 	case SDLK_e:
-		theChip8->keys[6] = keyStatus;
+		key = 6;
 		break;
 	case SDLK_r:
-		theChip8->keys[7] = keyStatus;
+		key = 7;
 		break;
 	case SDLK_a:
-		theChip8->keys[8] = keyStatus;
+		key = 8;
 		break;
 	case SDLK_s:
-		theChip8->keys[9] = keyStatus;
+		key = 9;
 		break;
 	case SDLK_d:
-		theChip8->keys[10] = keyStatus;
+		key = 10;
 		break;
 	case SDLK_f:
-		theChip8->keys[11] = keyStatus;
+		key = 11;
 		break;
 	case SDLK_z:
-		theChip8->keys[12] = keyStatus;
+		key = 12;
 		break;
 	case SDLK_x:
-		theChip8->keys[13] = keyStatus;
+		key = 13;
 		break;
 	case SDLK_c:
-		theChip8->keys[14] = keyStatus;
+		key = 14;
 		break;
 	case SDLK_v:
-		theChip8->keys[15] = keyStatus;
+		key = 15;
 		break;
 	}
-}
\ No newline at end of file
+
+	if (key >= 0)
+	{
+		theChip8->keys[key] = keyStatus;
+		// a stamp the ROM never read goes stale when the key is let go
+		theChip8->keyTimes[key] = keyStatus == Chip8::key_down ? eventTime : 0;
+	}
+}
+
+//----------------------------------------------------------------------------
+// pushSyntheticKeys - for --latency. Every 20 frames press the next key on
+// the keypad and let go of it 5 frames later
+//----------------------------------------------------------------------------
+void pushSyntheticKeys(int frame)
+{
+	static const SDL_Keycode keypad[Chip8::numKeys] =
+	{
+		SDLK_1, SDLK_2, SDLK_3, SDLK_4,
+		SDLK_q, SDLK_w, SDLK_e, SDLK_r,
+		SDLK_a, SDLK_s, SDLK_d, SDLK_f,
+		SDLK_z, SDLK_x, SDLK_c, SDLK_v
+	};
+
+	SDL_Event e = {};
+	e.key.keysym.sym = keypad[(frame / 20) % Chip8::numKeys];
+
+	if (frame % 20 == 0)
+	{
+		e.type = SDL_KEYDOWN;
+		e.key.state = SDL_PRESSED;
+		SDL_PushEvent(&e);
+	}
+	else if (frame % 20 == 5)
+	{
+		e.type = SDL_KEYUP;
+		e.key.state = SDL_RELEASED;
+		SDL_PushEvent(&e);
+	}
+}
+//----------------------------------------------------------------------------
+// exploreRoms - run the coverage explorer over every ROM in a directory,
+// report how much of each we reached and save a minimized input corpus
+// (<rom>.corpus) next to it. With replay, run each saved corpus instead
+// and report the coverage it gets
+//----------------------------------------------------------------------------
+int exploreRoms(std::string romDir, bool replay)
+{
+	const int framesPerInput = 10 * framerate;
+	const int inputsPerRom = 2000;
+	int numThreads = std::thread::hardware_concurrency();
+	if (numThreads < 1)
+	{
+		numThreads = 1;
+	}
+
+	std::error_code error;
+	for (auto &entry : std::filesystem::directory_iterator(romDir, error))
+	{
+		std::string extension = entry.path().extension().string();
+		if (extension != ".rom" && extension != ".ch8")
+		{
+			continue;
+		}
+
+		Explorer explorer(ticksPerFrame, framesPerInput);
+		if (!explorer.load(entry.path().string()))
+		{
+			continue;
+		}
+
+		std::string corpusFilename = entry.path().string() + ".corpus";
+		if (replay)
+		{
+			if (!std::filesystem::exists(corpusFilename) || !explorer.loadCorpus(corpusFilename))
+			{
+				continue;
+			}
+			explorer.replay();
+		}
+		else
+		{
+			explorer.run(numThreads, inputsPerRom);
+			explorer.minimize();
+			explorer.saveCorpus(corpusFilename);
+		}
+
+		cout << entry.path().filename().string() << ": "
+			<< explorer.coveragePercent() << "% ("
+			<< explorer.coveredBytes() << "/" << explorer.romSize() << " bytes), "
+			<< explorer.corpus.size() << " inputs in corpus" << endl;
+	}
+
+	if (error)
+	{
+		cout << "Could not read ROM directory " << romDir << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+// searchRam - cheat finder style RAM search driven by commands on stdin:
+//   run frames [keys]   run with the given keypad keys (hex digits) held
+//   eq / ne / inc / dec narrow to addresses that stayed the same, changed,
+//                       went up or went down since the last narrow
+//   val n               narrow to addresses holding n
+//   list                show the remaining candidates
+//   watch addr name     add an address (hex) to the watch list
+//   save                write the watch list to <rom>.watch
+//   quit
+//----------------------------------------------------------------------------
+int searchRam(std::string romFilename)
+{
+	Chip8 theChip8;
+	theChip8.reset();
+	if (!theChip8.load(romFilename))
+	{
+		return 1;
+	}
+
+	MemorySearch search;
+	search.start(&theChip8);
+
+	WatchList watchList;
+	std::string watchFilename = WatchList::filenameForRom(romFilename);
+	watchList.load(watchFilename);
+
+	std::string line;
+	while (std::getline(cin, line))
+	{
+		std::istringstream fields(line);
+		std::string command;
+		if (!(fields >> command))
+		{
+			continue;
+		}
+
+		if (command == "run")
+		{
+			int frames = 0;
+			std::string held;
+			fields >> frames >> held;
+			for (int k = 0; k < Chip8::numKeys; k++)
+			{
+				theChip8.keys[k] = Chip8::key_up;
+			}
+			for (size_t i = 0; i < held.size(); i++)
+			{
+				size_t k = std::string("0123456789abcdef").find((char)tolower(held[i]));
+				if (k != std::string::npos)
+				{
+					theChip8.keys[k] = Chip8::key_down;
+				}
+			}
+
+			for (int f = 0; f < frames; f++)
+			{
+				for (int i = 0; i < ticksPerFrame; i++)
+				{
+					theChip8.tick();
+				}
+				theChip8.updateTimers();
+			}
+		}
+		else if (command == "eq" || command == "ne" || command == "inc" || command == "dec" || command == "val")
+		{
+			MemorySearch::Predicate predicate = MemorySearch::search_value;
+			int value = 0;
+			if (command == "eq")
+			{
+				predicate = MemorySearch::search_equal;
+			}
+			else if (command == "ne")
+			{
+				predicate = MemorySearch::search_changed;
+			}
+			else if (command == "inc")
+			{
+				predicate = MemorySearch::search_increased;
+			}
+			else if (command == "dec")
+			{
+				predicate = MemorySearch::search_decreased;
+			}
+			else
+			{
+				fields >> value;
+			}
+
+			cout << search.narrow(&theChip8, predicate, (unsigned char)value) << " candidates" << endl;
+		}
+		else if (command == "list")
+		{
+			std::vector<unsigned short> candidates = search.candidates();
+			for (size_t i = 0; i < candidates.size() && i < 64; i++)
+			{
+				cout << hex << candidates[i] << dec << " = " << (int)theChip8.memory[candidates[i]] << endl;
+			}
+			if (candidates.size() > 64)
+			{
+				cout << "... " << candidates.size() - 64 << " more" << endl;
+			}
+		}
+		else if (command == "watch")
+		{
+			unsigned int address = 0;
+			std::string name;
+			if (fields >> hex >> address >> dec && address < Chip8::memorySize)
+			{
+				std::getline(fields >> ws, name);
+				watchList.add(address, name);
+			}
+			else
+			{
+				cout << "Usage: watch addr name" << endl;
+			}
+		}
+		else if (command == "save")
+		{
+			if (watchList.save(watchFilename))
+			{
+				cout << "Saved " << watchList.watches.size() << " watches to " << watchFilename << endl;
+			}
+		}
+		else if (command == "quit")
+		{
+			break;
+		}
+		else
+		{
+			cout << "Unknown command " << command << endl;
+		}
+	}
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+// checkHashes - run every ROM in a directory with random keys and make sure
+// the incremental stateHash() matches a full computeStateHash() after
+// every tick. Returns 1 on the first mismatch
+//----------------------------------------------------------------------------
+int checkHashes(std::string romDir)
+{
+	const int frames = 60 * framerate;
+	std::mt19937 rng(1234);
+	bool found = false;
+
+	std::error_code error;
+	for (auto &entry : std::filesystem::directory_iterator(romDir, error))
+	{
+		std::string extension = entry.path().extension().string();
+		if (extension != ".rom" && extension != ".ch8")
+		{
+			continue;
+		}
+
+		Chip8 theChip8;
+		theChip8.reset();
+		if (!theChip8.load(entry.path().string()))
+		{
+			continue;
+		}
+		found = true;
+
+		for (int f = 0; f < frames; f++)
+		{
+			for (int k = 0; k < Chip8::numKeys; k++)
+			{
+				theChip8.keys[k] = rng() % 8 == 0 ? Chip8::key_down : Chip8::key_up;
+			}
+
+			for (int i = 0; i < ticksPerFrame; i++)
+			{
+				theChip8.tick();
+				if (theChip8.stateHash() != theChip8.computeStateHash())
+				{
+					cout << entry.path().filename().string() << ": state hash mismatch at frame "
+						<< f << ", pc " << hex << theChip8.pc << dec << endl;
+					return 1;
+				}
+			}
+			theChip8.updateTimers();
+		}
+
+		cout << entry.path().filename().string() << ": ok" << endl;
+	}
+
+	if (error || !found)
+	{
+		cout << "No ROMs found in " << romDir << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//----------------------------------------------------------------------------
+// recompileRom
+//----------------------------------------------------------------------------
+int recompileRom(std::string romFilename, std::string outFilename)
+{
+	Recompiler recompiler;
+	if (!recompiler.load(romFilename))
+	{
+		return 1;
+	}
+
+	recompiler.discover();
+	if (!recompiler.write(outFilename))
+	{
+		return 1;
+	}
+
+	cout << "Wrote " << recompiler.numBlocks() << " blocks to " << outFilename << endl;
+	return 0;
+}
+
+#ifdef CHIP8_RECOMPILED
+//----------------------------------------------------------------------------
+// benchmarkRecompiled - run the same number of frames with no input on the
+// interpreter and the recompiled code, and check they end up in the
+// same state
+//----------------------------------------------------------------------------
+int benchmarkRecompiled(int frames)
+{
+	Chip8 interpreted;
+	Chip8 recompiled;
+
+	interpreted.reset();
+	loadRecompiledRom(&interpreted);
+	recompiled.reset();
+	loadRecompiledRom(&recompiled);
+
+	auto start = chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		for (int i = 0; i < ticksPerFrame; i++)
+		{
+			interpreted.tick();
+		}
+		interpreted.updateTimers();
+	}
+	auto middle = chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++)
+	{
+		runRecompiled(&recompiled, ticksPerFrame);
+		recompiled.updateTimers();
+	}
+	auto end = chrono::steady_clock::now();
+
+	double interpretedMs = chrono::duration<double, milli>(middle - start).count();
+	double recompiledMs = chrono::duration<double, milli>(end - middle).count();
+
+	cout << recompiledRomName << ": " << frames << " frames" << endl;
+	cout << "interpreter: " << interpretedMs << "ms" << endl;
+	cout << "recompiled:  " << recompiledMs << "ms" << endl;
+	cout << "speedup:     " << interpretedMs / recompiledMs << "x" << endl;
+
+	if (interpreted.stateHash() != recompiled.stateHash())
+	{
+		cout << "State mismatch between interpreter and recompiled code!" << endl;
+		return 1;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,244 @@
+//----------------------------------------------------------------------------
+// memsearch.cpp
+//----------------------------------------------------------------------------
+
+#include "memsearch.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// SSE2 is always there on x64, and on x86 when built with /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MEMSEARCH_SSE2
+#include <emmintrin.h>
+#endif
+
+//----------------------------------------------------------------------------
+// start - every address is a candidate
+//----------------------------------------------------------------------------
+void MemorySearch::start(Chip8 *theChip8)
+{
+	start(theChip8->memory);
+}
+
+void MemorySearch::start(const unsigned char *memory)
+{
+	memcpy(previous, memory, Chip8::memorySize);
+	memset(mask, 0xff, Chip8::memorySize);
+}
+
+//----------------------------------------------------------------------------
+// narrow - drop every candidate that doesn't match the predicate between
+// the last snapshot and this one. Returns how many candidates are left.
+// Call it once per recorded frame to search through a whole recording.
+//----------------------------------------------------------------------------
+int MemorySearch::narrow(Chip8 *theChip8, Predicate predicate, unsigned char value)
+{
+	return narrow(theChip8->memory, predicate, value);
+}
+
+int MemorySearch::narrow(const unsigned char *memory, Predicate predicate, unsigned char value)
+{
+#ifdef MEMSEARCH_SSE2
+	const __m128i ones = _mm_set1_epi8((char)0xff);
+	const __m128i target = _mm_set1_epi8((char)value);
+
+	for (int i = 0; i < Chip8::memorySize; i += 16)
+	{
+		__m128i cur = _mm_loadu_si128((const __m128i *)(memory + i));
+		__m128i prev = _mm_load_si128((const __m128i *)(previous + i));
+		__m128i match;
+
+		// there's no unsigned byte compare in SSE2, but max(a, b) == b
+		// tells us a <= b
+		switch (predicate)
+		{
+			case search_equal:
+				match = _mm_cmpeq_epi8(cur, prev);
+				break;
+			case search_changed:
+				match = _mm_xor_si128(_mm_cmpeq_epi8(cur, prev), ones);
+				break;
+			case search_increased:
+				match = _mm_xor_si128(_mm_cmpeq_epi8(_mm_max_epu8(cur, prev), prev), ones);
+				break;
+			case search_decreased:
+				match = _mm_xor_si128(_mm_cmpeq_epi8(_mm_max_epu8(cur, prev), cur), ones);
+				break;
+			default:
+				match = _mm_cmpeq_epi8(cur, target);
+				break;
+		}
+
+		__m128i m = _mm_and_si128(_mm_load_si128((const __m128i *)(mask + i)), match);
+		_mm_store_si128((__m128i *)(mask + i), m);
+		_mm_store_si128((__m128i *)(previous + i), cur);
+	}
+#else
+	for (int i = 0; i < Chip8::memorySize; i++)
+	{
+		bool match;
+		switch (predicate)
+		{
+			case search_equal:
+				match = memory[i] == previous[i];
+				break;
+			case search_changed:
+				match = memory[i] != previous[i];
+				break;
+			case search_increased:
+				match = memory[i] > previous[i];
+				break;
+			case search_decreased:
+				match = memory[i] < previous[i];
+				break;
+			default:
+				match = memory[i] == value;
+				break;
+		}
+
+		if (!match)
+		{
+			mask[i] = 0;
+		}
+		previous[i] = memory[i];
+	}
+#endif
+
+	return count();
+}
+
+//----------------------------------------------------------------------------
+// intersect - keep only the candidates that survived in another search too
+// (e.g. the same search run on a different instance)
+//----------------------------------------------------------------------------
+int MemorySearch::intersect(MemorySearch *other)
+{
+	for (int i = 0; i < Chip8::memorySize; i++)
+	{
+		mask[i] &= other->mask[i];
+	}
+	return count();
+}
+
+//----------------------------------------------------------------------------
+// count
+//----------------------------------------------------------------------------
+int MemorySearch::count()
+{
+	int total = 0;
+
+#ifdef MEMSEARCH_SSE2
+	for (int i = 0; i < Chip8::memorySize; i += 16)
+	{
+		int bits = _mm_movemask_epi8(_mm_load_si128((const __m128i *)(mask + i)));
+		while (bits)
+		{
+			bits &= bits - 1;
+			total++;
+		}
+	}
+#else
+	for (int i = 0; i < Chip8::memorySize; i++)
+	{
+		if (mask[i])
+		{
+			total++;
+		}
+	}
+#endif
+
+	return total;
+}
+
+//----------------------------------------------------------------------------
+// candidates
+//----------------------------------------------------------------------------
+std::vector<unsigned short> MemorySearch::candidates()
+{
+	std::vector<unsigned short> result;
+	for (int i = 0; i < Chip8::memorySize; i++)
+	{
+		if (mask[i])
+		{
+			result.push_back(i);
+		}
+	}
+	return result;
+}
+
+//----------------------------------------------------------------------------
+// WatchList::add
+//----------------------------------------------------------------------------
+void WatchList::add(unsigned short address, std::string name)
+{
+	Watch w;
+	w.address = address;
+	w.name = name;
+	watches.push_back(w);
+}
+
+//----------------------------------------------------------------------------
+// WatchList::read - cheap enough to poll every frame
+//----------------------------------------------------------------------------
+unsigned char WatchList::read(Chip8 *theChip8, int index)
+{
+	return theChip8->memory[watches[index].address];
+}
+
+//----------------------------------------------------------------------------
+// WatchList::save - one "address name" pair per line, address in hex
+//----------------------------------------------------------------------------
+bool WatchList::save(std::string filename)
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write watch file " << filename << std::endl;
+		return false;
+	}
+
+	for (size_t i = 0; i < watches.size(); i++)
+	{
+		file << std::hex << watches[i].address << " " << watches[i].name << std::endl;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// WatchList::load
+//----------------------------------------------------------------------------
+bool WatchList::load(std::string filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	watches.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream fields(line);
+		unsigned int address;
+		std::string name;
+
+		if (fields >> std::hex >> address && address < Chip8::memorySize)
+		{
+			std::getline(fields >> std::ws, name);
+			add(address, name);
+		}
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// WatchList::filenameForRom - watches live next to the ROM, e.g.
+// roms/invaders.rom.watch
+//----------------------------------------------------------------------------
+std::string WatchList::filenameForRom(std::string romFilename)
+{
+	return romFilename + ".watch";
+}
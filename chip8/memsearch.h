@@ -0,0 +1,59 @@
+#pragma once
+//----------------------------------------------------------------------------
+// memsearch.h
+// RAM search - narrows down candidate addresses (score, lives etc.) by
+// comparing successive snapshots of Chip8 memory, cheat finder style.
+//----------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+class MemorySearch {
+public:
+	enum Predicate
+	{
+		search_equal,		// same as last snapshot
+		search_changed,		// different to last snapshot
+		search_increased,
+		search_decreased,
+		search_value		// equal to a given value
+	};
+
+	MemorySearch() {};
+	~MemorySearch() {};
+
+	void start(Chip8 *theChip8);
+	void start(const unsigned char *memory);
+	int narrow(Chip8 *theChip8, Predicate predicate, unsigned char value = 0);
+	int narrow(const unsigned char *memory, Predicate predicate, unsigned char value = 0);
+	int intersect(MemorySearch *other);
+	int count();
+	std::vector<unsigned short> candidates();
+
+private:
+	// last snapshot, and 0xff for every address that's still a candidate
+	alignas(16) unsigned char previous[Chip8::memorySize];
+	alignas(16) unsigned char mask[Chip8::memorySize];
+};
+
+//----------------------------------------------------------------------------
+// WatchList - the handful of addresses we found, saved alongside the ROM
+//----------------------------------------------------------------------------
+class WatchList {
+public:
+	struct Watch
+	{
+		unsigned short address;
+		std::string name;
+	};
+
+	std::vector<Watch> watches;
+
+	void add(unsigned short address, std::string name);
+	unsigned char read(Chip8 *theChip8, int index);
+	bool save(std::string filename);
+	bool load(std::string filename);
+
+	static std::string filenameForRom(std::string romFilename);
+};
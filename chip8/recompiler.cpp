@@ -0,0 +1,607 @@
+//----------------------------------------------------------------------------
+// recompiler.cpp
+//----------------------------------------------------------------------------
+
+#include "recompiler.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+//----------------------------------------------------------------------------
+// hex - 0x0NNN style constant for the generated code
+//----------------------------------------------------------------------------
+static std::string hex(unsigned int value)
+{
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "0x%04X", value);
+	return buffer;
+}
+
+//----------------------------------------------------------------------------
+// load
+//----------------------------------------------------------------------------
+bool Recompiler::load(std::string filename)
+{
+	rom.reset();
+	if (!rom.load(filename))
+	{
+		return false;
+	}
+
+	std::ifstream romFile(filename, std::ios::binary | std::ios::ate);
+	romBytes = (int)romFile.tellg();
+
+	size_t slash = filename.find_last_of("/\\");
+	romName = slash == std::string::npos ? filename : filename.substr(slash + 1);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// isCode - we only compile instructions that are inside the ROM
+//----------------------------------------------------------------------------
+bool Recompiler::isCode(unsigned short address)
+{
+	return address >= Chip8::progBase && address + 1 < Chip8::progBase + romBytes;
+}
+
+//----------------------------------------------------------------------------
+// opcodeAt
+//----------------------------------------------------------------------------
+unsigned short Recompiler::opcodeAt(unsigned short address)
+{
+	return rom.memory[address] << 8 | rom.memory[address + 1];
+}
+
+//----------------------------------------------------------------------------
+// isSkip - 3XNN, 4XNN, 5XY0, 9XY0, EX9E, EXA1
+//----------------------------------------------------------------------------
+bool Recompiler::isSkip(unsigned short opcode)
+{
+	switch (opcode & 0xf000)
+	{
+		case 0x3000:
+		case 0x4000:
+		case 0x5000:
+		case 0x9000:
+			return true;
+		case 0xe000:
+			return (opcode & 0x00ff) == 0x009e || (opcode & 0x00ff) == 0x00a1;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// isNative - instructions we write out as C++
+//----------------------------------------------------------------------------
+bool Recompiler::isNative(unsigned short opcode)
+{
+	switch (opcode & 0xf000)
+	{
+		case 0x0000:
+			return (opcode & 0x000f) == 0x000e;
+		case 0x8000:
+			switch (opcode & 0x000f)
+			{
+				case 0x0000: case 0x0001: case 0x0002: case 0x0003:
+				case 0x0004: case 0x0005: case 0x0006: case 0x0007:
+				case 0x000e:
+					return true;
+			}
+			return false;
+		case 0xe000:
+			return isSkip(opcode);
+		case 0xf000:
+			switch (opcode & 0x00ff)
+			{
+				case 0x0007: case 0x0015: case 0x0018: case 0x001e: case 0x0029:
+					return true;
+			}
+			return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// isInterpreted - instructions we hand to decodeAndExecute, because they
+// can write over code, wait for keys, or are rare
+//----------------------------------------------------------------------------
+bool Recompiler::isInterpreted(unsigned short opcode)
+{
+	switch (opcode & 0xf000)
+	{
+		case 0x0000:
+			return (opcode & 0x000f) == 0x0000;
+		case 0xf000:
+			switch (opcode & 0x00ff)
+			{
+				case 0x000a: case 0x0033: case 0x0055: case 0x0065:
+					return true;
+			}
+			return false;
+	}
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// endsBlock - jumps, calls and returns, FX0A (it waits for a key) and
+// unknown opcodes, which the interpreter never steps past
+//----------------------------------------------------------------------------
+bool Recompiler::endsBlock(unsigned short opcode)
+{
+	switch (opcode & 0xf000)
+	{
+		case 0x1000:
+		case 0x2000:
+		case 0xb000:
+			return true;
+		case 0x0000:
+			return (opcode & 0x000f) == 0x000e || !isInterpreted(opcode);
+		case 0xf000:
+			return (opcode & 0x00ff) == 0x000a || !(isNative(opcode) || isInterpreted(opcode));
+	}
+	return !(isNative(opcode) || isInterpreted(opcode));
+}
+
+//----------------------------------------------------------------------------
+// discover - follow the control flow from the start of the ROM
+//----------------------------------------------------------------------------
+void Recompiler::discover()
+{
+	blocks.clear();
+
+	// execution starts at progBase (copied, as vector takes a reference)
+	std::vector<unsigned short> todo(1, (unsigned short)Chip8::progBase);
+
+	while (!todo.empty())
+	{
+		unsigned short start = todo.back();
+		todo.pop_back();
+
+		if (!isCode(start) || blocks.count(start) != 0)
+		{
+			continue;
+		}
+
+		Block &block = blocks[start];
+		block.start = start;
+
+		unsigned short address = start;
+		bool ended = false;
+		while (isCode(address) && block.addresses.size() < maxBlockLength)
+		{
+			unsigned short opcode = opcodeAt(address);
+			block.addresses.push_back(address);
+
+			if (isSkip(opcode))
+			{
+				todo.push_back(address + 4);
+			}
+
+			if ((opcode & 0xf000) == 0x1000)
+			{
+				todo.push_back(opcode & 0x0fff);
+			}
+			else if ((opcode & 0xf000) == 0x2000)
+			{
+				todo.push_back(opcode & 0x0fff);
+				todo.push_back(address + 2);
+			}
+			else if ((opcode & 0xf0ff) == 0xf00a)
+			{
+				todo.push_back(address + 2);
+			}
+
+			if (endsBlock(opcode))
+			{
+				ended = true;
+				break;
+			}
+			address += 2;
+		}
+
+		// ran out of room, carry on in a new block at the next instruction
+		if (!ended && block.addresses.size() == maxBlockLength)
+		{
+			todo.push_back(address);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// numBlocks
+//----------------------------------------------------------------------------
+int Recompiler::numBlocks()
+{
+	return (int)blocks.size();
+}
+
+//----------------------------------------------------------------------------
+// write - generate the C++
+//----------------------------------------------------------------------------
+bool Recompiler::write(std::string filename)
+{
+	std::ofstream out(filename);
+	if (!out.is_open())
+	{
+		std::cout << "Could not write " << filename << std::endl;
+		return false;
+	}
+
+	out << "//----------------------------------------------------------------------------\n"
+		<< "// " << romName << " recompiled by chip8 --recompile. Do not edit.\n"
+		<< "//----------------------------------------------------------------------------\n\n"
+		<< "#include <cstring>\n"
+		<< "#include \"recompiler.h\"\n\n";
+
+	out << "const char *recompiledRomName = \"" << romName << "\";\n"
+		<< "const int recompiledRomSize = " << romBytes << ";\n"
+		<< "const unsigned char recompiledRom[] =\n{";
+	for (int i = 0; i < romBytes; i++)
+	{
+		out << (i % 16 == 0 ? "\n\t" : " ") << hex(rom.memory[Chip8::progBase + i]) << ",";
+	}
+	out << "\n};\n\n";
+
+	// which bytes of the ROM we compiled, and which block to enter at
+	// each instruction. Once the ROM writes over one of them we can't
+	// trust the compiled code any more. Code the interpreter runs can
+	// write too, so this is needed even if no block has FX33/FX55
+	std::vector<int> codeMap(romBytes, 0);
+	std::map<unsigned short, unsigned short> entries;
+	for (auto &entry : blocks)
+	{
+		for (size_t i = 0; i < entry.second.addresses.size(); i++)
+		{
+			unsigned short address = entry.second.addresses[i];
+			codeMap[address - Chip8::progBase] = 1;
+			codeMap[address + 1 - Chip8::progBase] = 1;
+
+			// prefer the block that starts here, then the first one
+			// that runs through it
+			if (entries.count(address) == 0 || i == 0)
+			{
+				entries[address] = entry.first;
+			}
+		}
+	}
+
+	out << "// set once the ROM writes over its own code, cleared on load\n"
+		<< "static bool codeModified = false;\n\n";
+
+	out << "static const unsigned char codeMap[] =\n{";
+	for (int i = 0; i < romBytes; i++)
+	{
+		out << (i % 32 == 0 ? "\n\t" : " ") << codeMap[i] << ",";
+	}
+	out << "\n};\n\n";
+
+	out << "static bool touchesCode(unsigned short start, int length)\n{\n"
+		<< "\tfor (int a = start; a < start + length; a++)\n\t{\n"
+		<< "\t\tif (a >= Chip8::progBase && a < Chip8::progBase + recompiledRomSize && codeMap[a - Chip8::progBase])\n\t\t{\n"
+		<< "\t\t\treturn true;\n"
+		<< "\t\t}\n"
+		<< "\t}\n"
+		<< "\treturn false;\n"
+		<< "}\n\n";
+
+	// one interpreted instruction, with the same check the blocks make
+	// after FX33/FX55
+	out << "static void interpret(Chip8 *c)\n{\n"
+		<< "\tunsigned short opcode = c->memory[c->pc] << 8 | c->memory[c->pc + 1];\n"
+		<< "\tunsigned short start = c->I;\n"
+		<< "\tc->tick();\n"
+		<< "\tif ((opcode & 0xF0FF) == 0xF033 && touchesCode(start, 3))\n\t{\n"
+		<< "\t\tcodeModified = true;\n"
+		<< "\t}\n"
+		<< "\telse if ((opcode & 0xF0FF) == 0xF055 && touchesCode(start, ((opcode & 0x0F00) >> 8) + 1))\n\t{\n"
+		<< "\t\tcodeModified = true;\n"
+		<< "\t}\n"
+		<< "}\n\n";
+
+	for (auto &entry : blocks)
+	{
+		writeBlock(out, entry.second);
+	}
+
+	// pc -> block lookup for returns, BNNN, the end of each block and
+	// picking up where the last frame's budget ran out
+	out << "typedef void (*BlockFunction)(Chip8 *c, int &budget);\n\n"
+		<< "static const BlockFunction blockTable[] =\n{";
+	for (int i = 0; i < romBytes; i++)
+	{
+		unsigned short address = Chip8::progBase + i;
+		out << (i % 4 == 0 ? "\n\t" : " ");
+		if (entries.count(address) != 0)
+		{
+			out << "block_" << hex(entries[address]) << ",";
+		}
+		else
+		{
+			out << "nullptr,";
+		}
+	}
+	out << "\n};\n\n";
+
+	out << "static void dispatch(Chip8 *c, int &budget)\n{\n"
+		<< "\tint index = c->pc - Chip8::progBase;\n"
+		<< "\tif (index >= 0 && index < recompiledRomSize && blockTable[index] != nullptr)\n\t{\n"
+		<< "\t\tint start = budget;\n"
+		<< "\t\tblockTable[index](c, budget);\n"
+		<< "\t\tc->instructionCount += start - budget;\n"
+		<< "\t}\n"
+		<< "\telse\n\t{\n"
+		<< "\t\t// not found statically (BNNN etc.), use the interpreter\n"
+		<< "\t\tinterpret(c);\n"
+		<< "\t\tbudget--;\n"
+		<< "\t}\n"
+		<< "}\n\n";
+
+	out << "void loadRecompiledRom(Chip8 *theChip8)\n{\n"
+		<< "\tmemcpy(theChip8->memory + Chip8::progBase, recompiledRom, recompiledRomSize);\n"
+		<< "\ttheChip8->rehash();\n"
+		<< "\tcodeModified = false;\n"
+		<< "}\n\n";
+
+	out << "void runRecompiled(Chip8 *theChip8, int ticks)\n{\n"
+		<< "\tint budget = ticks;\n"
+		<< "\twhile (budget > 0)\n\t{\n"
+		<< "\t\tif (codeModified)\n\t\t{\n"
+		<< "\t\t\ttheChip8->tick();\n"
+		<< "\t\t\tbudget--;\n"
+		<< "\t\t}\n"
+		<< "\t\telse\n\t\t{\n"
+		<< "\t\t\tdispatch(theChip8, budget);\n"
+		<< "\t\t}\n"
+		<< "\t}\n}\n";
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// writeBlock - one function per block. pc is only stored when we leave
+// the block, and every instruction uses up one tick of the budget so
+// timing matches the interpreter exactly. A block can be entered at any
+// of its instructions, since the budget can run out anywhere in it
+//----------------------------------------------------------------------------
+void Recompiler::writeBlock(std::ostream &out, Block &block)
+{
+	out << "static void block_" << hex(block.start) << "(Chip8 *c, int &budget)\n{\n";
+	if (block.addresses.size() > 1)
+	{
+		out << "\tswitch (c->pc)\n\t{\n";
+		for (size_t i = 1; i < block.addresses.size(); i++)
+		{
+			out << "\t\tcase " << hex(block.addresses[i]) << ": goto L_" << hex(block.addresses[i]) << ";\n";
+		}
+		out << "\t}\n";
+	}
+	for (size_t i = 0; i < block.addresses.size(); i++)
+	{
+		writeInstruction(out, block, i);
+	}
+
+	// fell off the end of the block
+	unsigned short last = block.addresses.back();
+	if (!endsBlock(opcodeAt(last)))
+	{
+		out << "\tc->pc = " << hex(last + 2) << ";\n";
+	}
+	out << "}\n\n";
+}
+
+//----------------------------------------------------------------------------
+// writeInstruction
+//----------------------------------------------------------------------------
+void Recompiler::writeInstruction(std::ostream &out, Block &block, size_t index)
+{
+	unsigned short address = block.addresses[index];
+	unsigned short opcode = opcodeAt(address);
+	std::string next = hex(address + 2);
+	std::string x = hex((opcode & 0x0f00) >> 8);
+	std::string y = hex((opcode & 0x00f0) >> 4);
+	std::string nn = hex(opcode & 0x00ff);
+	std::string nnn = hex(opcode & 0x0fff);
+	std::string vx = "c->regs[" + x + "]";
+	std::string vy = "c->regs[" + y + "]";
+
+	// label if something in this block jumps or skips here. Every
+	// instruction after the first has one for the entry switch
+	if (index > 0)
+	{
+		out << "L_" << hex(address) << ":\n";
+	}
+	for (size_t i = 0; i < block.addresses.size() && index == 0; i++)
+	{
+		unsigned short op = opcodeAt(block.addresses[i]);
+		if ((isSkip(op) && i + 2 == index)
+			|| ((op & 0xf000) == 0x1000 && (op & 0x0fff) == address))
+		{
+			out << "L_" << hex(address) << ":\n";
+			break;
+		}
+	}
+
+	out << "\t// " << hex(address) << ": " << hex(opcode) << "\n";
+
+	std::string leave = "\tif (--budget <= 0) { c->pc = " + next + "; return; }\n";
+
+	if (isSkip(opcode))
+	{
+		std::string condition;
+		switch (opcode & 0xf000)
+		{
+			case 0x3000: condition = vx + " == " + nn; break;
+			case 0x4000: condition = vx + " != " + nn; break;
+			case 0x5000: condition = vx + " == " + vy; break;
+			case 0x9000: condition = vx + " != " + vy; break;
+			default:
+				condition = "c->readKey(" + vx + ") == " + ((opcode & 0x00ff) == 0x009e ? "1" : "0");
+				break;
+		}
+
+		std::string skipTo = hex(address + 4);
+		bool inBlock = index + 2 < block.addresses.size();
+
+		out << "\tif (" << condition << ")\n\t{\n";
+		if (inBlock)
+		{
+			out << "\t\tif (--budget <= 0) { c->pc = " << skipTo << "; return; }\n"
+				<< "\t\tgoto L_" << skipTo << ";\n";
+		}
+		else
+		{
+			out << "\t\tc->pc = " << skipTo << ";\n\t\tbudget--;\n\t\treturn;\n";
+		}
+		out << "\t}\n" << leave;
+		return;
+	}
+
+	if (!isNative(opcode))
+	{
+		// let the interpreter do it, and leave if it didn't step on
+		// (FX0A waiting, unknown opcode) or wrote over our code
+		out << "\t{\n";
+		if ((opcode & 0xf0ff) == 0xf033 || (opcode & 0xf0ff) == 0xf055)
+		{
+			int length = (opcode & 0x00ff) == 0x0033 ? 3 : ((opcode & 0x0f00) >> 8) + 1;
+			out << "\t\tunsigned short start = c->I;\n"
+				<< "\t\tc->pc = " << hex(address) << ";\n"
+				<< "\t\tc->decodeAndExecute(" << hex(opcode) << ");\n"
+				<< "\t\tif (touchesCode(start, " << length << ")) codeModified = true;\n";
+		}
+		else
+		{
+			out << "\t\tc->pc = " << hex(address) << ";\n"
+				<< "\t\tc->decodeAndExecute(" << hex(opcode) << ");\n";
+		}
+		out << "\t\tif (--budget <= 0 || codeModified || c->pc != " << next << ") return;\n"
+			<< "\t}\n";
+		return;
+	}
+
+	switch (opcode & 0xf000)
+	{
+		case 0x0000:
+			// 00EE
+			out << "\tc->pc = c->stack[--c->sp] + 2;\n\tbudget--;\n\treturn;\n";
+			return;
+		case 0x1000:
+		{
+			bool inBlock = false;
+			for (size_t i = 0; i < block.addresses.size(); i++)
+			{
+				inBlock = inBlock || block.addresses[i] == (opcode & 0x0fff);
+			}
+			if (inBlock)
+			{
+				out << "\tif (--budget <= 0) { c->pc = " << nnn << "; return; }\n"
+					<< "\tgoto L_" << nnn << ";\n";
+			}
+			else
+			{
+				out << "\tc->pc = " << nnn << ";\n\tbudget--;\n\treturn;\n";
+			}
+			return;
+		}
+		case 0x2000:
+			out << "\tc->writeStack(c->sp++, " << hex(address) << ");\n"
+				<< "\tc->pc = " << nnn << ";\n\tbudget--;\n\treturn;\n";
+			return;
+		case 0x6000:
+			out << "\tc->writeReg(" << x << ", " << nn << ");\n";
+			break;
+		case 0x7000:
+			out << "\tc->writeReg(" << x << ", " << vx << " + " << nn << ");\n";
+			break;
+		case 0x8000:
+			switch (opcode & 0x000f)
+			{
+				case 0x0000:
+					out << "\tc->writeReg(" << x << ", " << vy << ");\n";
+					break;
+				case 0x0001:
+					out << "\tc->writeReg(" << x << ", " << vx << " | " << vy << ");\n";
+					break;
+				case 0x0002:
+					out << "\tc->writeReg(" << x << ", " << vx << " & " << vy << ");\n";
+					break;
+				case 0x0003:
+					out << "\tc->writeReg(" << x << ", " << vx << " ^ " << vy << ");\n";
+					break;
+				case 0x0004:
+					out << "\tc->writeReg(0xf, " << vy << " > (0xFF - " << vx << ") ? 1 : 0);\n"
+						<< "\tc->writeReg(" << x << ", " << vx << " + " << vy << ");\n";
+					break;
+				case 0x0005:
+					out << "\tc->writeReg(0xf, " << vy << " > " << vx << " ? 0 : 1);\n"
+						<< "\tc->writeReg(" << x << ", " << vx << " - " << vy << ");\n";
+					break;
+				case 0x0006:
+					out << "\tc->writeReg(0xf, " << vx << " & 0x1);\n"
+						<< "\tc->writeReg(" << x << ", " << vx << " >> 1);\n";
+					break;
+				case 0x0007:
+					out << "\tc->writeReg(0xf, " << vx << " > " << vy << " ? 0 : 1);\n"
+						<< "\tc->writeReg(" << x << ", " << vy << " - " << vx << ");\n";
+					break;
+				case 0x000e:
+					out << "\tc->writeReg(0xf, " << vx << " >> 7);\n"
+						<< "\tc->writeReg(" << x << ", " << vx << " << 1);\n";
+					break;
+			}
+			break;
+		case 0xa000:
+			out << "\tc->I = " << nnn << ";\n";
+			break;
+		case 0xb000:
+			out << "\tc->pc = " << nnn << " + c->regs[0];\n\tbudget--;\n\treturn;\n";
+			return;
+		case 0xc000:
+			out << "\tc->writeReg(" << x << ", (c->random() % 255) & " << nn << ");\n";
+			break;
+		case 0xd000:
+			// same as the interpreter, but with the height known and
+			// skipping the blank ends of each sprite row
+			out << "\t{\n"
+				<< "\t\tint x = " << vx << ";\n"
+				<< "\t\tint y = " << vy << ";\n"
+				<< "\t\tc->writeReg(0xF, 0);\n"
+				<< "\t\tfor (int row = 0; row < " << (opcode & 0x000f) << "; row++)\n\t\t{\n"
+				<< "\t\t\tunsigned int bits = c->memory[c->I + row];\n"
+				<< "\t\t\tfor (int col = 0; bits != 0; col++, bits = (bits << 1) & 0xff)\n\t\t\t{\n"
+				<< "\t\t\t\tif ((bits & 0x80) && c->flipPixel(x + col + (y + row) * 64))\n\t\t\t\t{\n"
+				<< "\t\t\t\t\tc->writeReg(0xF, 1);\n"
+				<< "\t\t\t\t}\n"
+				<< "\t\t\t}\n"
+				<< "\t\t}\n"
+				<< "\t\tc->drawFlag = true;\n"
+				<< "\t\tc->drawCount++;\n"
+				<< "\t}\n";
+			break;
+		case 0xf000:
+			switch (opcode & 0x00ff)
+			{
+				case 0x0007:
+					out << "\tc->writeReg(" << x << ", c->delayTimer);\n";
+					break;
+				case 0x0015:
+					out << "\tc->delayTimer = " << vx << ";\n";
+					break;
+				case 0x0018:
+					out << "\tc->soundTimer = " << vx << ";\n";
+					break;
+				case 0x001e:
+					out << "\tc->writeReg(0xF, c->I + " << vx << " > 0xFFF ? 1 : 0);\n"
+						<< "\tc->I += " << vx << ";\n";
+					break;
+				case 0x0029:
+					// matches the interpreter, which uses X rather than VX
+					out << "\tc->I = " << hex(Chip8::fontBase + ((opcode & 0x0f00) >> 8) * 5) << ";\n";
+					break;
+			}
+			break;
+	}
+
+	out << leave;
+}
@@ -0,0 +1,64 @@
+#pragma once
+//----------------------------------------------------------------------------
+// recompiler.h
+// Ahead of time ROM to C++ recompiler. Finds the basic blocks reachable
+// from the start of a ROM and writes out a C++ file with one function
+// per block. Build that file into the emulator (see README) to get a
+// ROM specific executable. Anything that can't be found statically
+// (BNNN targets, code the ROM writes over) runs on the interpreter.
+//----------------------------------------------------------------------------
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "chip8.h"
+
+class Recompiler {
+public:
+	Recompiler() : romBytes(0) {};
+	~Recompiler() {};
+
+	bool load(std::string filename);
+	void discover();
+	bool write(std::string filename);
+
+	int numBlocks();
+
+private:
+	static const int maxBlockLength = 64;
+
+	struct Block
+	{
+		unsigned short start;
+		std::vector<unsigned short> addresses;	// instructions, in order
+	};
+
+	Chip8 rom;
+	std::string romName;
+	int romBytes;
+	std::map<unsigned short, Block> blocks;
+
+	bool isCode(unsigned short address);
+	unsigned short opcodeAt(unsigned short address);
+	static bool endsBlock(unsigned short opcode);
+	static bool isSkip(unsigned short opcode);
+	static bool isNative(unsigned short opcode);
+	static bool isInterpreted(unsigned short opcode);
+
+	void writeBlock(std::ostream &out, Block &block);
+	void writeInstruction(std::ostream &out, Block &block, size_t index);
+};
+
+//----------------------------------------------------------------------------
+// provided by the generated file (recompiled_rom.cpp)
+// The generated code keeps global state (whether the ROM has written
+// over its own code), so there is one recompiled machine per process.
+// loadRecompiledRom resets that state along with the machine's memory.
+//----------------------------------------------------------------------------
+extern const char *recompiledRomName;
+extern const unsigned char recompiledRom[];
+extern const int recompiledRomSize;
+
+void loadRecompiledRom(Chip8 *theChip8);
+void runRecompiled(Chip8 *theChip8, int ticks);
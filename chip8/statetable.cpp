@@ -0,0 +1,48 @@
+//----------------------------------------------------------------------------
+// statetable.cpp
+//----------------------------------------------------------------------------
+
+#include "statetable.h"
+
+//----------------------------------------------------------------------------
+// insert - returns true if we haven't seen this state before
+//----------------------------------------------------------------------------
+bool StateTable::insert(Chip8 *theChip8)
+{
+	return insert(theChip8->stateHash());
+}
+
+// or any other hash, e.g. just the screen (Chip8::screenHash)
+bool StateTable::insert(unsigned long long hash)
+{
+	return seen.insert(hash).second;
+}
+
+//----------------------------------------------------------------------------
+// contains
+//----------------------------------------------------------------------------
+bool StateTable::contains(Chip8 *theChip8)
+{
+	return contains(theChip8->stateHash());
+}
+
+bool StateTable::contains(unsigned long long hash)
+{
+	return seen.count(hash) != 0;
+}
+
+//----------------------------------------------------------------------------
+// size
+//----------------------------------------------------------------------------
+size_t StateTable::size()
+{
+	return seen.size();
+}
+
+//----------------------------------------------------------------------------
+// clear
+//----------------------------------------------------------------------------
+void StateTable::clear()
+{
+	seen.clear();
+}
@@ -0,0 +1,30 @@
+#pragma once
+//----------------------------------------------------------------------------
+// statetable.h
+// Remembers which machine states we've already seen, for searches/fuzzing
+//----------------------------------------------------------------------------
+
+#include <unordered_set>
+#include "chip8.h"
+
+class StateTable {
+public:
+	StateTable() {};
+	~StateTable() {};
+
+	bool insert(Chip8 *theChip8);
+	bool insert(unsigned long long hash);
+	bool contains(Chip8 *theChip8);
+	bool contains(unsigned long long hash);
+	size_t size();
+	void clear();
+
+private:
+	// the hashes are already well mixed so don't hash them again
+	struct IdentityHash
+	{
+		size_t operator()(unsigned long long h) const { return (size_t)h; }
+	};
+
+	std::unordered_set<unsigned long long, IdentityHash> seen;
+};
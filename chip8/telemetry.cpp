@@ -0,0 +1,489 @@
+//----------------------------------------------------------------------------
+// telemetry.cpp
+//----------------------------------------------------------------------------
+
+#include "telemetry.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+typedef SOCKET SocketType;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SocketType;
+#endif
+
+//----------------------------------------------------------------------------
+// closeSocket
+//----------------------------------------------------------------------------
+static void closeSocket(intptr_t s)
+{
+#ifdef _WIN32
+	closesocket((SocketType)s);
+#else
+	close((SocketType)s);
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Telemetry
+//----------------------------------------------------------------------------
+Telemetry::Telemetry()
+	: numInstances(0), stats(nullptr), statsFile(-1), statsMapping(0), listenSocket(-1)
+{
+	running = false;
+}
+
+Telemetry::~Telemetry()
+{
+	stop();
+}
+
+//----------------------------------------------------------------------------
+// start - publish every intervalMs. Pass port 0 for no Prometheus endpoint
+// or an empty filename for no stats file
+//----------------------------------------------------------------------------
+bool Telemetry::start(int port, std::string statsFilename, int intervalMs)
+{
+	if (running)
+	{
+		return false;
+	}
+
+	if (!statsFilename.empty() && !openStatsFile(statsFilename))
+	{
+		std::cout << "Could not open telemetry stats file " << statsFilename << std::endl;
+	}
+
+	if (port != 0 && !openServer(port))
+	{
+		std::cout << "Could not open telemetry port " << port << std::endl;
+	}
+
+	running = true;
+	aggregatorThread = std::thread(&Telemetry::aggregator, this, intervalMs);
+	if (listenSocket != -1)
+	{
+		serverThread = std::thread(&Telemetry::server, this);
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// stop
+//----------------------------------------------------------------------------
+void Telemetry::stop()
+{
+	running = false;
+
+	if (aggregatorThread.joinable())
+	{
+		aggregatorThread.join();
+	}
+	if (serverThread.joinable())
+	{
+		serverThread.join();
+	}
+
+	if (listenSocket != -1)
+	{
+		closeSocket(listenSocket);
+		listenSocket = -1;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	closeStatsFile();
+}
+
+//----------------------------------------------------------------------------
+// addInstance - get a Counters block for an emulator. Call once per
+// instance, from any thread
+//----------------------------------------------------------------------------
+Telemetry::Counters *Telemetry::addInstance(std::string name, int targetHz)
+{
+	std::lock_guard<std::mutex> lock(instancesMutex);
+	if (numInstances == maxInstances)
+	{
+		return nullptr;
+	}
+
+	Counters *c = &counters[numInstances];
+	size_t length = name.copy(c->name, sizeof(c->name) - 1);
+	c->name[length] = 0;
+	c->targetHz = targetHz;
+	c->instructions = 0;
+	c->draws = 0;
+	c->frames = 0;
+	c->framesLate = 0;
+	c->framesSkipped = 0;
+	for (int i = 0; i < frameSamples; i++)
+	{
+		c->frameTimesUs[i] = 0;
+	}
+
+	lastInstructions[numInstances] = 0;
+	lastDraws[numInstances] = 0;
+	numInstances++;
+	return c;
+}
+
+//----------------------------------------------------------------------------
+// recordFrame - call once a frame from the emulator's thread. Only that
+// thread writes these counters, so plain relaxed stores are enough and
+// tick() itself only bumps a normal member.
+//----------------------------------------------------------------------------
+void Telemetry::recordFrame(Counters *counters, Chip8 *theChip8, double frameMs, double targetFrameMs)
+{
+	if (counters == nullptr)
+	{
+		return;
+	}
+
+	unsigned long long frames = counters->frames.load(std::memory_order_relaxed);
+	counters->frameTimesUs[frames % frameSamples].store((unsigned int)(frameMs * 1000.0), std::memory_order_relaxed);
+
+	// late - took longer than a frame. skipped - took long enough that
+	// whole frames went by
+	if (frameMs > targetFrameMs + 1.0)
+	{
+		counters->framesLate.store(counters->framesLate.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (frameMs >= 2 * targetFrameMs)
+		{
+			unsigned long long skipped = (unsigned long long)(frameMs / targetFrameMs) - 1;
+			counters->framesSkipped.store(counters->framesSkipped.load(std::memory_order_relaxed) + skipped, std::memory_order_relaxed);
+		}
+	}
+
+	counters->instructions.store(theChip8->instructionCount, std::memory_order_relaxed);
+	counters->draws.store(theChip8->drawCount, std::memory_order_relaxed);
+	counters->frames.store(frames + 1, std::memory_order_release);
+}
+
+//----------------------------------------------------------------------------
+// openStatsFile - map a Stats struct into a file other processes can map
+//----------------------------------------------------------------------------
+bool Telemetry::openStatsFile(std::string filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, sizeof(Stats), NULL);
+	void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Stats)) : NULL;
+	if (view == NULL)
+	{
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+
+	statsFile = (intptr_t)file;
+	statsMapping = (intptr_t)mapping;
+#else
+	int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	void *view = MAP_FAILED;
+	if (ftruncate(fd, sizeof(Stats)) == 0)
+	{
+		view = mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (view == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	statsFile = fd;
+#endif
+
+	memset(view, 0, sizeof(Stats));
+	stats = (Stats *)view;
+	stats->magic = statsMagic;
+	stats->version = statsVersion;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// closeStatsFile
+//----------------------------------------------------------------------------
+void Telemetry::closeStatsFile()
+{
+	if (stats == nullptr)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(stats);
+	CloseHandle((HANDLE)statsMapping);
+	CloseHandle((HANDLE)statsFile);
+#else
+	munmap(stats, sizeof(Stats));
+	close((int)statsFile);
+#endif
+
+	stats = nullptr;
+	statsFile = -1;
+	statsMapping = 0;
+}
+
+//----------------------------------------------------------------------------
+// openServer - loopback only, we don't want this on the network
+//----------------------------------------------------------------------------
+bool Telemetry::openServer(int port)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		return false;
+	}
+#endif
+
+	SocketType s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ((intptr_t)s == -1)
+	{
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons((unsigned short)port);
+
+	if (bind(s, (sockaddr *)&address, sizeof(address)) != 0 || listen(s, 4) != 0)
+	{
+		closeSocket((intptr_t)s);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	listenSocket = (intptr_t)s;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// aggregator - background thread
+//----------------------------------------------------------------------------
+void Telemetry::aggregator(int intervalMs)
+{
+	auto last = std::chrono::steady_clock::now();
+
+	while (running)
+	{
+		// sleep in small steps so stop() doesn't have to wait long
+		for (int slept = 0; slept < intervalMs && running; slept += 50)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		aggregate(std::chrono::duration<double>(now - last).count());
+		last = now;
+	}
+}
+
+//----------------------------------------------------------------------------
+// aggregate - turn the counters into stats and publish them
+//----------------------------------------------------------------------------
+void Telemetry::aggregate(double seconds)
+{
+	int count;
+	{
+		std::lock_guard<std::mutex> lock(instancesMutex);
+		count = numInstances;
+	}
+
+	std::vector<InstanceStats> results(count);
+	std::vector<unsigned int> times;
+
+	for (int i = 0; i < count; i++)
+	{
+		Counters *c = &counters[i];
+		InstanceStats &r = results[i];
+		memset(&r, 0, sizeof(r));
+
+		r.frames = c->frames.load(std::memory_order_acquire);
+		r.instructions = c->instructions.load(std::memory_order_relaxed);
+		r.framesLate = c->framesLate.load(std::memory_order_relaxed);
+		r.framesSkipped = c->framesSkipped.load(std::memory_order_relaxed);
+		unsigned long long draws = c->draws.load(std::memory_order_relaxed);
+
+		memcpy(r.name, c->name, sizeof(r.name));
+		r.targetHz = c->targetHz;
+		r.achievedHz = (r.instructions - lastInstructions[i]) / seconds;
+		r.drawsPerSecond = (draws - lastDraws[i]) / seconds;
+		lastInstructions[i] = r.instructions;
+		lastDraws[i] = draws;
+
+		// percentiles over the last frameSamples frames
+		times.clear();
+		for (unsigned long long f = 0; f < r.frames && f < (unsigned long long)frameSamples; f++)
+		{
+			times.push_back(c->frameTimesUs[f].load(std::memory_order_relaxed));
+		}
+		if (!times.empty())
+		{
+			std::sort(times.begin(), times.end());
+			r.frameMsP50 = times[(times.size() - 1) * 50 / 100] / 1000.0;
+			r.frameMsP90 = times[(times.size() - 1) * 90 / 100] / 1000.0;
+			r.frameMsP99 = times[(times.size() - 1) * 99 / 100] / 1000.0;
+		}
+	}
+
+	if (stats != nullptr)
+	{
+		unsigned int sequence = stats->sequence.load(std::memory_order_relaxed);
+		stats->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		stats->numInstances = count;
+		for (int i = 0; i < count; i++)
+		{
+			stats->instances[i] = results[i];
+		}
+
+		stats->sequence.store(sequence + 2, std::memory_order_release);
+	}
+
+	// Prometheus text exposition format
+	std::ostringstream text;
+	text.precision(10);
+
+	auto header = [&](const char *name, const char *type, const char *help)
+	{
+		text << "# HELP " << name << " " << help << "\n"
+			<< "# TYPE " << name << " " << type << "\n";
+	};
+	auto gauge = [&](const char *name, const char *help, double InstanceStats::*field)
+	{
+		header(name, "gauge", help);
+		for (int i = 0; i < count; i++)
+		{
+			text << name << "{instance=\"" << results[i].name << "\"} " << results[i].*field << "\n";
+		}
+	};
+	auto counter = [&](const char *name, const char *help, unsigned long long InstanceStats::*field)
+	{
+		header(name, "counter", help);
+		for (int i = 0; i < count; i++)
+		{
+			text << name << "{instance=\"" << results[i].name << "\"} " << results[i].*field << "\n";
+		}
+	};
+
+	gauge("chip8_cpu_hz", "Instructions executed per second", &InstanceStats::achievedHz);
+	gauge("chip8_cpu_target_hz", "Configured clock speed", &InstanceStats::targetHz);
+	gauge("chip8_draws_per_second", "DXYN sprite draws per second", &InstanceStats::drawsPerSecond);
+	counter("chip8_instructions_total", "Instructions executed", &InstanceStats::instructions);
+	counter("chip8_frames_total", "Frames run", &InstanceStats::frames);
+	counter("chip8_frames_late_total", "Frames that took longer than the frame budget", &InstanceStats::framesLate);
+	counter("chip8_frames_skipped_total", "Whole frames lost to late frames", &InstanceStats::framesSkipped);
+
+	header("chip8_frame_time_ms", "summary", "Time between frames over the last 256 frames");
+	for (int i = 0; i < count; i++)
+	{
+		std::string label = std::string("chip8_frame_time_ms{instance=\"") + results[i].name + "\",quantile=";
+		text << label << "\"0.5\"} " << results[i].frameMsP50 << "\n"
+			<< label << "\"0.9\"} " << results[i].frameMsP90 << "\n"
+			<< label << "\"0.99\"} " << results[i].frameMsP99 << "\n";
+	}
+
+	std::lock_guard<std::mutex> lock(textMutex);
+	prometheusText = text.str();
+}
+
+//----------------------------------------------------------------------------
+// server - answers every connection with the latest metrics, whatever
+// was asked for
+//----------------------------------------------------------------------------
+void Telemetry::server()
+{
+	while (running)
+	{
+		// wait with a timeout so we notice stop()
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET((SocketType)listenSocket, &readSet);
+		timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000;
+
+		if (select((int)listenSocket + 1, &readSet, NULL, NULL, &timeout) <= 0)
+		{
+			continue;
+		}
+
+		SocketType client = accept((SocketType)listenSocket, NULL, NULL);
+		if ((intptr_t)client == -1)
+		{
+			continue;
+		}
+
+		// don't let a client that connects and says nothing hold up stop()
+		FD_ZERO(&readSet);
+		FD_SET(client, &readSet);
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+
+		if (select((int)client + 1, &readSet, NULL, NULL, &timeout) <= 0)
+		{
+			closeSocket((intptr_t)client);
+			continue;
+		}
+
+		char request[1024];
+		recv(client, request, sizeof(request), 0);
+
+		std::string body;
+		{
+			std::lock_guard<std::mutex> lock(textMutex);
+			body = prometheusText;
+		}
+
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+			<< "Content-Type: text/plain; version=0.0.4\r\n"
+			<< "Content-Length: " << body.size() << "\r\n"
+			<< "Connection: close\r\n\r\n"
+			<< body;
+
+		std::string out = response.str();
+		send(client, out.c_str(), (int)out.size(), 0);
+		closeSocket((intptr_t)client);
+	}
+}
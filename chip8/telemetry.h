@@ -0,0 +1,98 @@
+#pragma once
+//----------------------------------------------------------------------------
+// telemetry.h
+// Runtime metrics for long running hosts. Each emulator thread owns a
+// Counters block it updates with relaxed atomic stores once a frame; a
+// background thread turns them into rates and percentiles every interval
+// and publishes them to a memory mapped stats file and a Prometheus text
+// endpoint on 127.0.0.1.
+//----------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "chip8.h"
+
+class Telemetry {
+public:
+	static const int maxInstances = 16;
+	static const int frameSamples = 256;
+	static const unsigned int statsMagic = 0x38504843;	// "CHP8"
+	static const unsigned int statsVersion = 1;
+
+	// written by one emulator thread, read by the aggregator
+	struct Counters
+	{
+		char name[32];
+		int targetHz;
+		std::atomic<unsigned long long> instructions;
+		std::atomic<unsigned long long> draws;
+		std::atomic<unsigned long long> frames;
+		std::atomic<unsigned long long> framesLate;
+		std::atomic<unsigned long long> framesSkipped;
+		std::atomic<unsigned int> frameTimesUs[frameSamples];	// ring buffer
+	};
+
+	struct InstanceStats
+	{
+		char name[32];
+		double targetHz;
+		double achievedHz;
+		double drawsPerSecond;
+		double frameMsP50;
+		double frameMsP90;
+		double frameMsP99;
+		unsigned long long instructions;
+		unsigned long long frames;
+		unsigned long long framesLate;
+		unsigned long long framesSkipped;
+	};
+
+	// layout of the stats file. sequence is odd while it's being written,
+	// readers should retry if it changes under them
+	struct Stats
+	{
+		unsigned int magic;
+		unsigned int version;
+		std::atomic<unsigned int> sequence;
+		unsigned int numInstances;
+		InstanceStats instances[maxInstances];
+	};
+
+	Telemetry();
+	~Telemetry();
+
+	bool start(int port, std::string statsFilename, int intervalMs);
+	void stop();
+	Counters *addInstance(std::string name, int targetHz);
+
+	static void recordFrame(Counters *counters, Chip8 *theChip8, double frameMs, double targetFrameMs);
+
+private:
+	Counters counters[maxInstances];
+	int numInstances;
+	std::mutex instancesMutex;
+
+	// aggregator state
+	unsigned long long lastInstructions[maxInstances];
+	unsigned long long lastDraws[maxInstances];
+	Stats *stats;
+	intptr_t statsFile;		// HANDLE on Windows, fd elsewhere
+	intptr_t statsMapping;	// Windows only
+	std::string prometheusText;
+	std::mutex textMutex;
+
+	std::atomic<bool> running;
+	std::thread aggregatorThread;
+	std::thread serverThread;
+	intptr_t listenSocket;
+
+	bool openStatsFile(std::string filename);
+	void closeStatsFile();
+	bool openServer(int port);
+	void aggregator(int intervalMs);
+	void server();
+	void aggregate(double seconds);
+};